@@ -0,0 +1,2402 @@
+#include "liblk.h"
+#include <aclapi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/* Branch prediction macros for performance */
+#if defined(__GNUC__)
+#define LIKELY(x)   (__builtin_expect(!!(x), 1))
+#define UNLIKELY(x) (__builtin_expect(!!(x), 0))
+#else
+#define LIKELY(x)   (x)
+#define UNLIKELY(x) (x)
+#endif
+
+/* Thread-local storage qualifier */
+#if defined(_MSC_VER)
+#define LK_THREAD_LOCAL __declspec(thread)
+#else
+#define LK_THREAD_LOCAL __thread
+#endif
+
+#define INITIAL_CAPACITY 128
+
+/* Fill options with the defaults used by the lk command line */
+void lkDefaultOptions(LkOptions *options) {
+    static const LkOptions defaults = {
+        .showAll = 0, .longFormat = 1, .recursive = 0, .sortBySize = 0,
+        .sortByTime = 0, .sortByExtension = 0, .reverseSort = 0, .humanSize = 1,
+        .fileTypeIndicator = 1, .listDirs = 0, .groupDirs = 1, .showCreationTime = 0,
+        .treeView = 0, .naturalSort = 1, .showFullPath = 0, .showOwner = 0,
+        .showSummary = 1, .filterPattern = "", .maxDepth = -1, .pruneCount = 0,
+        .predicateCount = 0, .inodeOrder = 0, .throttle = NULL, .archiveCache = NULL
+    };
+    *options = defaults;
+}
+
+/* Initialize FileList with INITIAL_CAPACITY */
+int lkInitFileList(FileList *list) {
+    list->count = 0;
+    list->capacity = INITIAL_CAPACITY;
+    list->entries = (FileEntry *)malloc(list->capacity * sizeof(FileEntry));
+    if (UNLIKELY(!list->entries)) {
+        list->capacity = 0;
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return 0;
+    }
+    return 1;
+}
+
+/* Append a copy of entry, doubling capacity with an overflow check when full */
+int lkAddFileEntry(FileList *list, const FileEntry *entry) {
+    if (UNLIKELY(list->count >= list->capacity)) {
+        /* Prevent integer overflow when doubling capacity */
+        size_t newCapacity = list->capacity ? list->capacity * 2 : INITIAL_CAPACITY;
+        if (list->capacity > SIZE_MAX / 2 / sizeof(FileEntry)) {
+            SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+            return 0;
+        }
+        FileEntry *temp = (FileEntry *)realloc(list->entries, newCapacity * sizeof(FileEntry));
+        if (UNLIKELY(!temp)) {
+            SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+            return 0;
+        }
+        list->entries = temp;
+        list->capacity = newCapacity;
+    }
+    list->entries[list->count++] = *entry;
+    return 1;
+}
+
+/* Free the FileList memory */
+void lkFreeFileList(FileList *list) {
+    free(list->entries);
+    list->entries = NULL;
+    list->count = list->capacity = 0;
+}
+
+/* Fast ASCII lowercase conversion */
+static inline int fast_tolower(int c) {
+    return (c >= 'A' && c <= 'Z') ? (c | 0x20) : c;
+}
+
+/*
+ * lkJoinPath: Safely concatenates the base and child paths into the result buffer.
+ * The snprintf return value is checked so that a truncated path is reported as
+ * ERROR_FILENAME_EXCED_RANGE instead of silently naming a different file.
+ */
+int lkJoinPath(const char *restrict base, const char *restrict child, char *restrict result, size_t size) {
+    if (UNLIKELY(!base || !child || !result || size == 0)) {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return 0;
+    }
+    size_t baseLen = strlen(base);
+    int needsSlash = (baseLen && (base[baseLen - 1] != '\\' && base[baseLen - 1] != '/'));
+    int written;
+    if (needsSlash)
+        written = snprintf(result, size, "%s\\%s", base, child);
+    else
+        written = snprintf(result, size, "%s%s", base, child);
+    if (written < 0 || (size_t)written >= size) {
+        SetLastError(ERROR_FILENAME_EXCED_RANGE);
+        return 0;
+    }
+    return 1;
+}
+
+/* Format the "dRHSA" attribute string; needs a buffer of at least 6 characters */
+int lkFormatAttributes(DWORD attr, int isDir, char *restrict outStr, size_t size) {
+    if (size < 6) {
+        SetLastError(ERROR_INSUFFICIENT_BUFFER);
+        return 0;
+    }
+
+    static const char flags[5] = { 'd', 'R', 'H', 'S', 'A' };
+    static const DWORD masks[5] = {
+        0,  /* Directory is handled separately */
+        FILE_ATTRIBUTE_READONLY,
+        FILE_ATTRIBUTE_HIDDEN,
+        FILE_ATTRIBUTE_SYSTEM,
+        FILE_ATTRIBUTE_ARCHIVE
+    };
+
+    outStr[0] = isDir ? flags[0] : '-';
+    outStr[1] = (attr & masks[1]) ? flags[1] : '-';
+    outStr[2] = (attr & masks[2]) ? flags[2] : '-';
+    outStr[3] = (attr & masks[3]) ? flags[3] : '-';
+    outStr[4] = (attr & masks[4]) ? flags[4] : '-';
+    outStr[5] = '\0';
+    return 1;
+}
+
+/* Write the low width decimal digits of value, zero-padded */
+static inline char *putDigits(char *restrict out, unsigned value, int width) {
+    for (int i = width - 1; i >= 0; i--) {
+        out[i] = (char)('0' + value % 10);
+        value /= 10;
+    }
+    return out + width;
+}
+
+/*
+ * lkFileTimeToString: Converts a FILETIME structure to a local "YYYY-MM-DD HH:MM:SS" string.
+ * The buffer must hold at least 20 characters (21 past the year 9999); a timestamp that
+ * does not fit is reported instead of being truncated.
+ */
+int lkFileTimeToString(const FILETIME *ft, char *restrict buffer, size_t size) {
+    if (size < 20) {
+        SetLastError(ERROR_INSUFFICIENT_BUFFER);
+        return 0;
+    }
+    SYSTEMTIME stUTC, stLocal;
+    if (!FileTimeToSystemTime(ft, &stUTC))
+        return 0;
+    if (!SystemTimeToTzSpecificLocalTime(NULL, &stUTC, &stLocal))
+        return 0;
+    const int yearDigits = stLocal.wYear > 9999 ? 5 : 4;
+    if (size < (size_t)yearDigits + 16) {
+        SetLastError(ERROR_INSUFFICIENT_BUFFER);
+        return 0;
+    }
+    char *p = putDigits(buffer, stLocal.wYear, yearDigits);
+    *p++ = '-';
+    p = putDigits(p, stLocal.wMonth, 2);
+    *p++ = '-';
+    p = putDigits(p, stLocal.wDay, 2);
+    *p++ = ' ';
+    p = putDigits(p, stLocal.wHour, 2);
+    *p++ = ':';
+    p = putDigits(p, stLocal.wMinute, 2);
+    *p++ = ':';
+    p = putDigits(p, stLocal.wSecond, 2);
+    *p = '\0';
+    return 1;
+}
+
+/* lkFormatUnsigned: Decimal digits of value; returns their count, 0 if the buffer is too small */
+size_t lkFormatUnsigned(ULONGLONG value, char *restrict buffer, size_t size) {
+    char digits[20];
+    size_t n = 0;
+    do {
+        digits[sizeof(digits) - ++n] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    if (n >= size) {
+        SetLastError(ERROR_INSUFFICIENT_BUFFER);
+        return 0;
+    }
+    memcpy(buffer, digits + sizeof(digits) - n, n);
+    buffer[n] = '\0';
+    return n;
+}
+
+/*
+ * lkFormatSize: Format file size; scale to human-readable units if requested.
+ * Integer only: a scaled size is split into whole units and tenths with shifts. Exact
+ * ties in the tenths round up, as "%.1f" does in msvcrt.dll, so the output matches the
+ * earlier floating-point formatting of MinGW builds (for sizes below 2^53 bytes, where
+ * the old double arithmetic was still exact). UCRT and glibc round such ties to even,
+ * so there a size like 1280 bytes now reads "1.3K" where it used to read "1.2K".
+ * Returns the length written, truncating to fit the buffer like snprintf.
+ */
+size_t lkFormatSize(ULONGLONG size, char *restrict buffer, size_t bufferSize, int humanReadable) {
+    static const char suffixes[6] = { 'B', 'K', 'M', 'G', 'T', 'P' };
+    char text[28];
+    size_t n;
+
+    if (!humanReadable || size < 1024) {
+        n = lkFormatUnsigned(size, text, sizeof(text));
+        if (humanReadable)
+            text[n++] = suffixes[0];
+    } else {
+        /* Largest unit the size reaches, up to petabytes */
+        int i = 1;
+        while (i < 5 && (size >> (10 * (i + 1))))
+            i++;
+        const int shift = 10 * i;
+        const ULONGLONG mask = (1ULL << shift) - 1;
+        ULONGLONG whole = size >> shift;
+        const ULONGLONG scaled = (size & mask) * 10;   /* Below 10 << 50, no overflow */
+        unsigned tenths = (unsigned)(scaled >> shift);
+        const ULONGLONG rest = scaled & mask, half = 1ULL << (shift - 1);
+        if (rest >= half)
+            tenths++;
+        if (tenths == 10) {
+            whole++;
+            tenths = 0;
+        }
+        n = lkFormatUnsigned(whole, text, sizeof(text));
+        text[n++] = '.';
+        text[n++] = (char)('0' + tenths);
+        text[n++] = suffixes[i];
+    }
+
+    if (!bufferSize)
+        return 0;
+    if (n >= bufferSize)
+        n = bufferSize - 1;
+    memcpy(buffer, text, n);
+    buffer[n] = '\0';
+    return n;
+}
+
+/*
+ * Optimized naturalCompare:
+ * Uses the inlined fast_tolower function for converting characters to lowercase,
+ * which improves performance by avoiding repeated inline conditional logic.
+ */
+static int naturalCompare(const char *restrict a, const char *restrict b) {
+    const unsigned char *ua = (const unsigned char *)a;
+    const unsigned char *ub = (const unsigned char *)b;
+
+    while (*ua && *ub) {
+        if (isdigit(*ua) && isdigit(*ub)) {
+            /* Fast path for single-digit numbers */
+            if (!isdigit(ua[1]) && !isdigit(ub[1])) {
+                if (*ua != *ub)
+                    return *ua - *ub;
+                ua++; ub++;
+                continue;
+            }
+            /* Parse multi-digit numbers efficiently */
+            unsigned long numA = 0, numB = 0;
+            do { numA = numA * 10 + (*ua++ - '0'); } while (isdigit(*ua));
+            do { numB = numB * 10 + (*ub++ - '0'); } while (isdigit(*ub));
+            if (numA != numB)
+                return (numA < numB) ? -1 : 1;
+        } else {
+            /* Utilize fast_tolower to reduce per-character overhead */
+            unsigned char ca = fast_tolower(*ua);
+            unsigned char cb = fast_tolower(*ub);
+            if (ca != cb)
+                return ca - cb;
+            ua++; ub++;
+        }
+    }
+
+    return (*ua) ? 1 : ((*ub) ? -1 : 0);
+}
+
+/* Compare two FileEntry items with support for various sort options */
+int lkCompareEntries(const LkOptions *options, const FileEntry *fa, const FileEntry *fb) {
+    const DWORD attrA = fa->findData.dwFileAttributes;
+    const DWORD attrB = fb->findData.dwFileAttributes;
+    const int aIsDir = (attrA & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    const int bIsDir = (attrB & FILE_ATTRIBUTE_DIRECTORY) != 0;
+
+    /* Fast path for directory grouping */
+    if (options->groupDirs && aIsDir != bIsDir)
+        return aIsDir ? -1 : 1;
+
+    /* Time-based sorting */
+    if (options->sortByTime) {
+        /* Direct 64-bit composition instead of bit shifting */
+        ULONGLONG ta = (((ULONGLONG)fa->findData.ftLastWriteTime.dwHighDateTime) << 32) |
+                         fa->findData.ftLastWriteTime.dwLowDateTime;
+        ULONGLONG tb = (((ULONGLONG)fb->findData.ftLastWriteTime.dwHighDateTime) << 32) |
+                         fb->findData.ftLastWriteTime.dwLowDateTime;
+
+        if (ta != tb) {
+            /* Combine conditional with return to eliminate branch */
+            int result = (ta < tb) ? -1 : 1;
+            return options->reverseSort ? -result : result;
+        }
+    }
+
+    /* Size-based sorting */
+    if (options->sortBySize) {
+        ULONGLONG sa = (((ULONGLONG)fa->findData.nFileSizeHigh) << 32) | fa->findData.nFileSizeLow;
+        ULONGLONG sb = (((ULONGLONG)fb->findData.nFileSizeHigh) << 32) | fb->findData.nFileSizeLow;
+
+        if (sa != sb) {
+            int result = (sa < sb) ? -1 : 1;
+            return options->reverseSort ? -result : result;
+        }
+    }
+
+    /* Extension-based sorting - only do string operations if needed */
+    if (options->sortByExtension) {
+        const char *extA = strrchr(fa->findData.cFileName, '.');
+        const char *extB = strrchr(fb->findData.cFileName, '.');
+
+        /* Handle various extension cases efficiently */
+        if (!extA && !extB) {
+            /* No extensions, fall through to name comparison */
+        } else if (extA && !extB) {
+            return options->reverseSort ? -1 : 1;
+        } else if (!extA && extB) {
+            return options->reverseSort ? 1 : -1;
+        } else {
+            int result = _stricmp(extA, extB);
+            if (result) {
+                return options->reverseSort ? -result : result;
+            }
+        }
+    }
+
+    /* Name-based sorting as fallback */
+    int result = options->naturalSort ?
+                 naturalCompare(fa->findData.cFileName, fb->findData.cFileName) :
+                 _stricmp(fa->findData.cFileName, fb->findData.cFileName);
+
+    return options->reverseSort ? -result : result;
+}
+
+/*
+ * qsort has no context argument, so the options of the sort in progress are
+ * parked in a thread-local slot. Each thread sorts with its own options, and
+ * the previous value is restored afterwards in case a caller nests sorts.
+ */
+static LK_THREAD_LOCAL const LkOptions *t_sortOptions;
+
+static int compareEntriesThunk(const void *a, const void *b) {
+    return lkCompareEntries(t_sortOptions, (const FileEntry *)a, (const FileEntry *)b);
+}
+
+/* Sort a FileList in place according to options */
+void lkSortFileList(const LkOptions *options, FileList *list) {
+    if (list->count < 2)
+        return;
+    const LkOptions *saved = t_sortOptions;
+    t_sortOptions = options;
+    qsort(list->entries, list->count, sizeof(FileEntry), compareEntriesThunk);
+    t_sortOptions = saved;
+}
+
+/* Simple wildcard matching with support for '?' and '*' */
+int lkWildcardMatch(const char *restrict pattern, const char *restrict str) {
+    /* Fast path for exact matching or empty pattern */
+    if (!pattern[0]) return !str[0];
+    if (!str[0]) return pattern[0] == '*' && !pattern[1];
+
+    /* Use more efficient pointer tracking for pattern matching */
+    const char *s = str;
+    const char *p = pattern;
+    const char *star_p = NULL;
+    const char *star_s = NULL;
+
+    while (*s) {
+        /* Direct char match or single wildcard */
+        if (*p == '?' || ((*p | 0x20) == (*s | 0x20))) {
+            p++;
+            s++;
+        }
+        /* Star wildcard handling with backtracking information */
+        else if (*p == '*') {
+            star_p = p++;
+            star_s = s;
+            /* Skip consecutive stars - they're redundant */
+            while (*p == '*') p++;
+            if (!*p) return 1; /* Trailing star matches everything */
+        }
+        /* Backtrack to last star if available */
+        else if (star_p) {
+            p = star_p + 1;
+            s = ++star_s;
+        }
+        else {
+            return 0;
+        }
+    }
+
+    /* Skip any trailing stars */
+    while (*p == '*') p++;
+
+    return !*p;
+}
+
+/* Relative evaluation cost of each predicate kind; cheaper ones run first */
+static int predicateCost(LkPredicateKind kind) {
+    switch (kind) {
+        case LK_PRED_TYPE:
+        case LK_PRED_ATTR:  return 0;   /* Bit tests on the find data */
+        case LK_PRED_SIZE:
+        case LK_PRED_NEWER:
+        case LK_PRED_OLDER: return 1;   /* Integer compares on the find data */
+        case LK_PRED_NAME:  return 2;   /* Glob match on the name */
+        default:            return 3;   /* Needs extra system calls */
+    }
+}
+
+/* Insert predicate after every predicate of the same or lower cost */
+int lkAddPredicate(LkOptions *options, const LkPredicate *predicate) {
+    if (options->predicateCount >= LK_MAX_PREDICATES) {
+        SetLastError(ERROR_INSUFFICIENT_BUFFER);
+        return 0;
+    }
+    int cost = predicateCost(predicate->kind);
+    int i = options->predicateCount++;
+    while (i > 0 && predicateCost(options->predicates[i - 1].kind) > cost) {
+        options->predicates[i] = options->predicates[i - 1];
+        i--;
+    }
+    options->predicates[i] = *predicate;
+    return 1;
+}
+
+/* Evaluate one predicate against an entry of directory */
+static int matchPredicate(const LkPredicate *predicate, const char *restrict directory, const FileEntry *entry) {
+    const WIN32_FIND_DATAA *data = &entry->findData;
+    const DWORD attr = data->dwFileAttributes;
+    switch (predicate->kind) {
+        case LK_PRED_TYPE: {
+            DWORD type = (attr & FILE_ATTRIBUTE_REPARSE_POINT) ? LK_TYPE_LINK :
+                         (attr & FILE_ATTRIBUTE_DIRECTORY) ? LK_TYPE_DIR : LK_TYPE_FILE;
+            return (predicate->setMask & type) != 0;
+        }
+        case LK_PRED_ATTR:
+            return (attr & predicate->setMask) == predicate->setMask && !(attr & predicate->clearMask);
+        case LK_PRED_SIZE: {
+            if (attr & FILE_ATTRIBUTE_DIRECTORY)
+                return 0;
+            ULONGLONG size = (((ULONGLONG)data->nFileSizeHigh) << 32) | data->nFileSizeLow;
+            return predicate->compare < 0 ? size < predicate->value :
+                   predicate->compare > 0 ? size > predicate->value : size == predicate->value;
+        }
+        case LK_PRED_NEWER:
+        case LK_PRED_OLDER: {
+            ULONGLONG mtime = (((ULONGLONG)data->ftLastWriteTime.dwHighDateTime) << 32) |
+                              data->ftLastWriteTime.dwLowDateTime;
+            return predicate->kind == LK_PRED_NEWER ? mtime > predicate->value : mtime < predicate->value;
+        }
+        case LK_PRED_NAME:
+            return lkWildcardMatch(predicate->pattern, data->cFileName);
+        case LK_PRED_OWNER: {
+            char fullPath[MAX_PATH], owner[512];
+            /* Archive members have no owner to match */
+            if ((entry->flags & LK_ENTRY_ARCHIVE_MEMBER) ||
+                !lkJoinPath(directory, data->cFileName, fullPath, sizeof(fullPath)) ||
+                !lkGetFileOwner(fullPath, owner, sizeof(owner)))
+                return 0;
+            const char *name = strrchr(owner, '\\');
+            return lkWildcardMatch(predicate->pattern, owner) ||
+                   (name && lkWildcardMatch(predicate->pattern, name + 1));
+        }
+    }
+    return 0;
+}
+
+/* Nonzero if entry of directory passes every predicate; stops at the first failure */
+int lkMatchPredicates(const LkOptions *options, const char *restrict directory, const FileEntry *entry) {
+    for (int i = 0; i < options->predicateCount; i++) {
+        if (!matchPredicate(&options->predicates[i], directory, entry))
+            return 0;
+    }
+    return 1;
+}
+
+/* Retrieve file owner as "DOMAIN\\Name"; returns 1 on success */
+int lkGetFileOwner(const char *restrict filePath, char *restrict owner, DWORD ownerSize) {
+    char stackBuffer[1024];
+    DWORD dwSize = sizeof(stackBuffer);
+    PSECURITY_DESCRIPTOR psd = (PSECURITY_DESCRIPTOR)stackBuffer;
+    int allocated = 0;
+    if (!GetFileSecurityA(filePath, OWNER_SECURITY_INFORMATION, psd, dwSize, &dwSize)) {
+        if (GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+            return 0;
+        psd = (PSECURITY_DESCRIPTOR)malloc(dwSize);
+        if (!psd) {
+            SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+            return 0;
+        }
+        allocated = 1;
+        if (!GetFileSecurityA(filePath, OWNER_SECURITY_INFORMATION, psd, dwSize, &dwSize)) {
+            DWORD err = GetLastError();
+            free(psd);
+            SetLastError(err);
+            return 0;
+        }
+    }
+    PSID pSid = NULL;
+    BOOL ownerDefaulted = FALSE;
+    char name[256] = {0}, domain[256] = {0};
+    DWORD nameSize = sizeof(name), domainSize = sizeof(domain);
+    SID_NAME_USE sidType;
+    int ok = GetSecurityDescriptorOwner(psd, &pSid, &ownerDefaulted) && pSid &&
+             LookupAccountSidA(NULL, pSid, name, &nameSize, domain, &domainSize, &sidType);
+    DWORD err = GetLastError();
+    if (allocated)
+        free(psd);
+    if (!ok) {
+        SetLastError(err);
+        return 0;
+    }
+    snprintf(owner, ownerSize, "%s\\%s", domain, name);
+    return 1;
+}
+
+/* Nonzero if a directory called name matches one of the prune globs */
+int lkIsPruned(const LkOptions *options, const char *restrict name) {
+    for (int i = 0; i < options->pruneCount; i++) {
+        if (lkWildcardMatch(options->prunePatterns[i], name))
+            return 1;
+    }
+    return 0;
+}
+
+/* Nonzero if recursion may open a directory at depth (the listed root is depth 0) */
+int lkWithinDepth(const LkOptions *options, int depth) {
+    return options->maxDepth < 0 || depth <= options->maxDepth;
+}
+
+/* Entries read between two trips to the token bucket */
+#define THROTTLE_BATCH 32
+
+/*
+ * lkThrottleInit: rate in entries per second (0 = no cap), maxConcurrency directories
+ * enumerated at once (0 = no cap). The bucket holds a tenth of a second's worth.
+ */
+int lkThrottleInit(LkThrottle *throttle, double rate, int maxConcurrency) {
+    memset(throttle, 0, sizeof(*throttle));
+    if (maxConcurrency > 0) {
+        throttle->slots = CreateSemaphoreA(NULL, maxConcurrency, maxConcurrency, NULL);
+        if (!throttle->slots)
+            return 0;
+    }
+    LARGE_INTEGER now, frequency;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&now);
+    throttle->rate = rate > 0 ? rate : 0;
+    throttle->burst = throttle->rate / 10 > THROTTLE_BATCH ? throttle->rate / 10 : THROTTLE_BATCH;
+    throttle->tokens = throttle->burst;
+    throttle->last = now.QuadPart;
+    throttle->frequency = (double)frequency.QuadPart;
+    InitializeCriticalSection(&throttle->lock);
+    return 1;
+}
+
+void lkThrottleFree(LkThrottle *throttle) {
+    if (throttle->slots)
+        CloseHandle(throttle->slots);
+    DeleteCriticalSection(&throttle->lock);
+    memset(throttle, 0, sizeof(*throttle));
+}
+
+/* lkThrottleTake: Spend count tokens, sleeping for as long as the bucket is overdrawn */
+void lkThrottleTake(LkThrottle *throttle, double count) {
+    if (!throttle || throttle->rate <= 0)
+        return;
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    EnterCriticalSection(&throttle->lock);
+    throttle->tokens += (double)(now.QuadPart - throttle->last) / throttle->frequency * throttle->rate;
+    if (throttle->tokens > throttle->burst)
+        throttle->tokens = throttle->burst;
+    throttle->last = now.QuadPart;
+    throttle->tokens -= count;
+    double debt = -throttle->tokens;
+    LeaveCriticalSection(&throttle->lock);
+    /* Debts under a millisecond carry over to the next caller */
+    if (debt > 0) {
+        DWORD ms = (DWORD)(debt * 1000.0 / throttle->rate);
+        if (ms)
+            Sleep(ms);
+    }
+}
+
+/*
+ * deliverEntry: the per-entry filtering shared by directory and archive enumeration.
+ * Returns the callback's verdict, or 1 when the entry was filtered out.
+ */
+static int deliverEntry(const LkOptions *options, const char *restrict directory, const char *restrict wildcard,
+                        FileEntry *entry, LkEntryCallback callback, void *context) {
+    WIN32_FIND_DATAA *findData = &entry->findData;
+
+    /* Skip current and parent directory entries */
+    if (findData->cFileName[0] == '.' &&
+        (findData->cFileName[1] == '\0' ||
+         (findData->cFileName[1] == '.' && findData->cFileName[2] == '\0')))
+        return 1;
+
+    /* Filter out hidden files unless showAll is enabled */
+    if (!options->showAll && (findData->dwFileAttributes & FILE_ATTRIBUTE_HIDDEN))
+        return 1;
+
+    /* Apply wildcard filter if present */
+    if (wildcard[0] && !lkWildcardMatch(wildcard, findData->cFileName))
+        return 1;
+
+    /* Predicates run cheapest first; failing directories stay reachable for recursion */
+    entry->flags &= ~LK_ENTRY_TRAVERSE_ONLY;
+    if (options->predicateCount && !lkMatchPredicates(options, directory, entry)) {
+        if (!options->recursive ||
+            (findData->dwFileAttributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_REPARSE_POINT)) !=
+                FILE_ATTRIBUTE_DIRECTORY)
+            return 1;
+        entry->flags |= LK_ENTRY_TRAVERSE_ONLY;
+    }
+
+    return callback(context, entry);
+}
+
+/*
+ * Archives listed as directories.
+ * A path such as "C:\rel\build.zip\bin" names the "bin/" folder inside build.zip.
+ * Zip files are memory-mapped and only their central directory is read; tar files
+ * are read header by header with the payload blocks skipped. Nothing is decompressed.
+ * Folders that only appear as path prefixes of archive members are synthesized.
+ */
+typedef enum { ARCHIVE_NONE, ARCHIVE_ZIP, ARCHIVE_TAR } ArchiveKind;
+
+/* Set of folder names already reported, so implied folders appear once */
+typedef struct {
+    char **slots;
+    size_t capacity;  // Power of two
+    size_t count;
+} NameSet;
+
+static ULONGLONG hashPath(const char *restrict name, size_t len) {
+    ULONGLONG hash = 1469598103934665603ULL;   /* FNV-1a, case-insensitive */
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char)fast_tolower((unsigned char)name[i])) * 1099511628211ULL;
+    return hash;
+}
+
+/* Returns 1 if name was added, 0 if already present, -1 when out of memory */
+static int nameSetInsert(NameSet *set, const char *restrict name) {
+    if ((set->count + 1) * 2 > set->capacity) {
+        size_t newCapacity = set->capacity ? set->capacity * 2 : 64;
+        char **slots = (char **)calloc(newCapacity, sizeof(char *));
+        if (!slots)
+            return -1;
+        for (size_t i = 0; i < set->capacity; i++) {
+            if (!set->slots[i])
+                continue;
+            size_t j = (size_t)hashPath(set->slots[i], strlen(set->slots[i])) & (newCapacity - 1);
+            while (slots[j])
+                j = (j + 1) & (newCapacity - 1);
+            slots[j] = set->slots[i];
+        }
+        free(set->slots);
+        set->slots = slots;
+        set->capacity = newCapacity;
+    }
+    size_t i = (size_t)hashPath(name, strlen(name)) & (set->capacity - 1);
+    while (set->slots[i]) {
+        if (!_stricmp(set->slots[i], name))
+            return 0;
+        i = (i + 1) & (set->capacity - 1);
+    }
+    size_t len = strlen(name) + 1;
+    set->slots[i] = (char *)malloc(len);
+    if (!set->slots[i])
+        return -1;
+    memcpy(set->slots[i], name, len);
+    set->count++;
+    return 1;
+}
+
+static void nameSetFree(NameSet *set) {
+    for (size_t i = 0; i < set->capacity; i++)
+        free(set->slots[i]);
+    free(set->slots);
+    set->slots = NULL;
+    set->capacity = set->count = 0;
+}
+
+/*
+ * Find the archive file inside directory. On success archivePath holds the archive
+ * itself and *inner points at the path within it ("" for its root). Paths without a
+ * ".zip" or ".tar" component are rejected without touching the file system.
+ */
+static ArchiveKind findArchive(const char *restrict directory, char *restrict archivePath, const char **inner) {
+    for (const char *p = strchr(directory, '.'); p; p = strchr(p + 1, '.')) {
+        ArchiveKind kind = !_strnicmp(p, ".zip", 4) ? ARCHIVE_ZIP :
+                           !_strnicmp(p, ".tar", 4) ? ARCHIVE_TAR : ARCHIVE_NONE;
+        if (kind == ARCHIVE_NONE || (p[4] && p[4] != '\\' && p[4] != '/'))
+            continue;
+        size_t len = (size_t)(p + 4 - directory);
+        if (len >= MAX_PATH)
+            return ARCHIVE_NONE;
+        memcpy(archivePath, directory, len);
+        archivePath[len] = '\0';
+        DWORD attr = GetFileAttributesA(archivePath);
+        if (attr == INVALID_FILE_ATTRIBUTES || (attr & FILE_ATTRIBUTE_DIRECTORY))
+            continue;
+        *inner = p[4] ? p + 5 : p + 4;
+        return kind;
+    }
+    return ARCHIVE_NONE;
+}
+
+/* A member recorded for an LkArchiveCache: what scanZip/scanTar pass to archiveMember */
+typedef struct {
+    size_t nameOffset;         // Into the table's names
+    size_t nameLen;
+    int isDir;
+    ULONGLONG size;
+    FILETIME mtime;
+    DWORD attributes;
+} ArchiveRecord;
+
+struct LkArchiveTable {
+    char path[MAX_PATH];
+    FILETIME archiveTime;
+    ArchiveRecord *records;
+    size_t count, capacity;
+    char *names;               // Member names as found in the archive, not NUL-terminated
+    size_t namesUsed, namesCapacity;
+};
+
+static void freeArchiveTable(struct LkArchiveTable *table) {
+    free(table->records);
+    free(table->names);
+    free(table);
+}
+
+void lkArchiveCacheInit(LkArchiveCache *cache) {
+    memset(cache, 0, sizeof(*cache));
+    InitializeCriticalSection(&cache->lock);
+}
+
+void lkArchiveCacheFree(LkArchiveCache *cache) {
+    for (size_t i = 0; i < cache->count; i++)
+        freeArchiveTable(cache->tables[i]);
+    DeleteCriticalSection(&cache->lock);
+    memset(cache, 0, sizeof(*cache));
+}
+
+static struct LkArchiveTable *findArchiveTable(LkArchiveCache *cache, const char *restrict path) {
+    struct LkArchiveTable *table = NULL;
+    EnterCriticalSection(&cache->lock);
+    for (size_t i = 0; i < cache->count && !table; i++) {
+        if (!_stricmp(cache->tables[i]->path, path))
+            table = cache->tables[i];
+    }
+    LeaveCriticalSection(&cache->lock);
+    return table;
+}
+
+/* Hand table to the cache; returns 0, leaving it with the caller, when the cache is full or has the archive already */
+static int addArchiveTable(LkArchiveCache *cache, struct LkArchiveTable *table) {
+    int added = 0;
+    EnterCriticalSection(&cache->lock);
+    if (cache->count < LK_ARCHIVE_CACHE_SIZE) {
+        added = 1;
+        for (size_t i = 0; i < cache->count && added; i++)
+            added = _stricmp(cache->tables[i]->path, table->path) != 0;
+        if (added)
+            cache->tables[cache->count++] = table;
+    }
+    LeaveCriticalSection(&cache->lock);
+    return added;
+}
+
+/* Append one member to table; returns 0 when out of memory */
+static int recordArchiveMember(struct LkArchiveTable *table, const char *restrict name, size_t nameLen, int isDir,
+                               ULONGLONG size, const FILETIME *mtime, DWORD attributes) {
+    if (table->count == table->capacity) {
+        size_t capacity = table->capacity ? table->capacity * 2 : 256;
+        ArchiveRecord *records = (ArchiveRecord *)realloc(table->records, capacity * sizeof(ArchiveRecord));
+        if (!records)
+            return 0;
+        table->records = records;
+        table->capacity = capacity;
+    }
+    if (table->namesUsed + nameLen > table->namesCapacity) {
+        size_t capacity = table->namesCapacity ? table->namesCapacity * 2 : 16384;
+        while (capacity < table->namesUsed + nameLen)
+            capacity *= 2;
+        char *names = (char *)realloc(table->names, capacity);
+        if (!names)
+            return 0;
+        table->names = names;
+        table->namesCapacity = capacity;
+    }
+    ArchiveRecord *record = &table->records[table->count++];
+    record->nameOffset = table->namesUsed;
+    record->nameLen = nameLen;
+    record->isDir = isDir;
+    record->size = size;
+    record->mtime = *mtime;
+    record->attributes = attributes;
+    memcpy(table->names + table->namesUsed, name, nameLen);
+    table->namesUsed += nameLen;
+    return 1;
+}
+
+/* State for one archive folder listing */
+typedef struct {
+    const LkOptions *options;
+    const char *directory;     // Path as given, for predicates
+    const char *wildcard;
+    LkEntryCallback callback;
+    void *context;
+    char prefix[MAX_PATH];     // Folder inside the archive, '/'-separated with a trailing '/', or ""
+    size_t prefixLen;
+    FILETIME archiveTime;      // Timestamp for synthesized folders
+    NameSet folders;
+    int stopped;               // Callback asked to stop
+    int failed;                // Out of memory
+    struct LkArchiveTable *record;   // Members are recorded here for the cache instead of listed
+} ArchiveScan;
+
+/*
+ * Offer one archive member, given by its full '/'-separated name, to the listing.
+ * Members below the listed folder surface as their first path component.
+ */
+static void archiveMember(ArchiveScan *scan, const char *restrict name, size_t nameLen, int isDir,
+                          ULONGLONG size, const FILETIME *mtime, DWORD attributes) {
+    if (scan->stopped || scan->failed)
+        return;
+    if (scan->record) {
+        scan->failed = !recordArchiveMember(scan->record, name, nameLen, isDir, size, mtime, attributes);
+        return;
+    }
+    /* Normalize "./" and "/" prefixes produced by some archivers */
+    for (;;) {
+        if (nameLen >= 2 && name[0] == '.' && name[1] == '/') { name += 2; nameLen -= 2; }
+        else if (nameLen >= 1 && name[0] == '/') { name++; nameLen--; }
+        else break;
+    }
+    if (nameLen <= scan->prefixLen || _strnicmp(name, scan->prefix, scan->prefixLen))
+        return;
+    const char *rest = name + scan->prefixLen;
+    size_t restLen = nameLen - scan->prefixLen;
+    const char *slash = (const char *)memchr(rest, '/', restLen);
+    if (slash) {
+        if ((size_t)(slash - rest) + 1 < restLen) {
+            /* Deeper member: report the folder it lives in */
+            mtime = &scan->archiveTime;
+            attributes = 0;
+            size = 0;
+        }
+        restLen = (size_t)(slash - rest);
+        isDir = 1;
+    }
+    if (restLen == 0 || restLen >= MAX_PATH)
+        return;
+
+    FileEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.flags = LK_ENTRY_ARCHIVE_MEMBER;
+    memcpy(entry.findData.cFileName, rest, restLen);
+    if (isDir) {
+        int inserted = nameSetInsert(&scan->folders, entry.findData.cFileName);
+        if (inserted < 0) {
+            scan->failed = 1;
+            return;
+        }
+        if (!inserted)
+            return;
+        attributes = (attributes & ~FILE_ATTRIBUTE_NORMAL) | FILE_ATTRIBUTE_DIRECTORY;
+        size = 0;
+    }
+    entry.findData.dwFileAttributes = attributes ? attributes : FILE_ATTRIBUTE_NORMAL;
+    entry.findData.nFileSizeHigh = (DWORD)(size >> 32);
+    entry.findData.nFileSizeLow = (DWORD)size;
+    entry.findData.ftCreationTime = *mtime;
+    entry.findData.ftLastAccessTime = *mtime;
+    entry.findData.ftLastWriteTime = *mtime;
+    if (!deliverEntry(scan->options, scan->directory, scan->wildcard, &entry, scan->callback, scan->context))
+        scan->stopped = 1;
+}
+
+/* Little-endian field readers for archive structures */
+static inline DWORD readLE16(const unsigned char *p) { return (DWORD)p[0] | ((DWORD)p[1] << 8); }
+static inline DWORD readLE32(const unsigned char *p) { return readLE16(p) | (readLE16(p + 2) << 16); }
+static inline ULONGLONG readLE64(const unsigned char *p) { return readLE32(p) | ((ULONGLONG)readLE32(p + 4) << 32); }
+
+/* Map size bytes of a file mapping starting at an arbitrary offset; *base receives the view to unmap */
+static const unsigned char *mapRange(HANDLE hMapping, ULONGLONG offset, ULONGLONG size, void **base) {
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    ULONGLONG aligned = offset - (offset % si.dwAllocationGranularity);
+    ULONGLONG length = size + (offset - aligned);
+    if (length > (SIZE_T)-1) {
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return NULL;
+    }
+    *base = MapViewOfFile(hMapping, FILE_MAP_READ, (DWORD)(aligned >> 32), (DWORD)aligned, (SIZE_T)length);
+    return *base ? (const unsigned char *)*base + (offset - aligned) : NULL;
+}
+
+/* Convert an archive name in codePage to the ANSI code page used by WIN32_FIND_DATAA */
+static size_t archiveNameToAnsi(UINT codePage, const char *restrict text, size_t len, char *restrict out, size_t outSize) {
+    WCHAR wide[MAX_PATH * 2];   /* Full member paths, not just one component, may exceed MAX_PATH */
+    int wideLen = MultiByteToWideChar(codePage, 0, text, (int)len, wide, MAX_PATH * 2);
+    /* Code page 437 may be missing from stripped-down systems; the OEM code page is the closest */
+    if (wideLen <= 0 && codePage == 437)
+        wideLen = MultiByteToWideChar(CP_OEMCP, 0, text, (int)len, wide, MAX_PATH * 2);
+    if (wideLen <= 0)
+        return 0;
+    int outLen = WideCharToMultiByte(CP_ACP, 0, wide, wideLen, out, (int)outSize - 1, NULL, NULL);
+    return outLen > 0 ? (size_t)outLen : 0;
+}
+
+#define ZIP_EOCD_SIG     0x06054b50
+#define ZIP64_LOCATOR_SIG 0x07064b50
+#define ZIP64_EOCD_SIG   0x06064b50
+#define ZIP_CENTRAL_SIG  0x02014b50
+
+/* Walk the central directory of a zip file */
+static int scanZip(ArchiveScan *scan, HANDLE hFile, ULONGLONG fileSize) {
+    HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!hMapping)
+        return 0;
+
+    /* The end of central directory record sits in the last 64 KiB + 22 bytes */
+    ULONGLONG tailSize = fileSize < 22 + 65535 + 20 ? fileSize : 22 + 65535 + 20;
+    void *tailBase;
+    const unsigned char *tail = mapRange(hMapping, fileSize - tailSize, tailSize, &tailBase);
+    if (!tail) {
+        CloseHandle(hMapping);
+        return 0;
+    }
+    const unsigned char *eocd = NULL;
+    for (ULONGLONG i = tailSize >= 22 ? tailSize - 22 + 1 : 0; i-- > 0;) {
+        if (readLE32(tail + i) == ZIP_EOCD_SIG) {
+            eocd = tail + i;
+            break;
+        }
+    }
+    if (!eocd) {
+        UnmapViewOfFile(tailBase);
+        CloseHandle(hMapping);
+        SetLastError(ERROR_BAD_FORMAT);
+        return 0;
+    }
+    ULONGLONG cdSize = readLE32(eocd + 12);
+    ULONGLONG cdOffset = readLE32(eocd + 16);
+    if ((cdSize == 0xFFFFFFFF || cdOffset == 0xFFFFFFFF || readLE16(eocd + 10) == 0xFFFF) &&
+        eocd - tail >= 20 && readLE32(eocd - 20) == ZIP64_LOCATOR_SIG) {
+        /* Zip64: the real sizes live in the zip64 end of central directory record */
+        ULONGLONG recordOffset = readLE64(eocd - 20 + 8);
+        void *recordBase;
+        const unsigned char *record = recordOffset + 56 <= fileSize ?
+            mapRange(hMapping, recordOffset, 56, &recordBase) : NULL;
+        if (record && readLE32(record) == ZIP64_EOCD_SIG) {
+            cdSize = readLE64(record + 40);
+            cdOffset = readLE64(record + 48);
+        }
+        if (record)
+            UnmapViewOfFile(recordBase);
+    }
+    UnmapViewOfFile(tailBase);
+    if (cdOffset > fileSize || cdSize > fileSize - cdOffset) {
+        CloseHandle(hMapping);
+        SetLastError(ERROR_BAD_FORMAT);
+        return 0;
+    }
+
+    void *cdBase = NULL;
+    const unsigned char *p = cdSize ? mapRange(hMapping, cdOffset, cdSize, &cdBase) : NULL;
+    if (cdSize && !p) {
+        CloseHandle(hMapping);
+        return 0;
+    }
+    const unsigned char *end = p + cdSize;
+    while (p && end - p >= 46 && readLE32(p) == ZIP_CENTRAL_SIG && !scan->stopped && !scan->failed) {
+        DWORD flags = readLE16(p + 8);
+        DWORD dosTime = readLE16(p + 12), dosDate = readLE16(p + 14);
+        ULONGLONG size = readLE32(p + 24);
+        DWORD nameLen = readLE16(p + 28), extraLen = readLE16(p + 30), commentLen = readLE16(p + 32);
+        DWORD hostAttr = (readLE16(p + 4) >> 8) == 0 ? (readLE32(p + 38) & 0xFF) : 0;
+        if ((ULONGLONG)(end - p) < 46ULL + nameLen + extraLen + commentLen)
+            break;
+        const char *name = (const char *)p + 46;
+        const unsigned char *extra = p + 46 + nameLen;
+
+        /* Zip64 extended information carries sizes that overflowed 32 bits */
+        if (size == 0xFFFFFFFF) {
+            for (const unsigned char *e = extra; e + 4 <= extra + extraLen;) {
+                DWORD id = readLE16(e), len = readLE16(e + 2);
+                if (e + 4 + len > extra + extraLen)
+                    break;
+                if (id == 0x0001 && len >= 8) {
+                    size = readLE64(e + 4);
+                    break;
+                }
+                e += 4 + len;
+            }
+        }
+
+        FILETIME localTime, mtime;
+        if (!DosDateTimeToFileTime((WORD)dosDate, (WORD)dosTime, &localTime) ||
+            !LocalFileTimeToFileTime(&localTime, &mtime))
+            mtime = scan->archiveTime;
+
+        /* Bit 11 marks UTF-8 names; without it the zip specification says IBM code page 437 */
+        char converted[MAX_PATH * 2];
+        size_t convertedLen = archiveNameToAnsi((flags & 0x800) ? CP_UTF8 : 437, name, nameLen,
+                                                converted, sizeof(converted));
+        name = converted;
+        if (convertedLen) {
+            int isDir = name[convertedLen - 1] == '/' || (hostAttr & FILE_ATTRIBUTE_DIRECTORY);
+            archiveMember(scan, name, convertedLen, isDir, size, &mtime,
+                          hostAttr & (FILE_ATTRIBUTE_READONLY | FILE_ATTRIBUTE_HIDDEN |
+                                      FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_ARCHIVE));
+        }
+        p += 46 + nameLen + extraLen + commentLen;
+    }
+    if (cdBase)
+        UnmapViewOfFile(cdBase);
+    CloseHandle(hMapping);
+    return 1;
+}
+
+/* Read exactly size bytes; returns 1 on success */
+static int readExact(HANDLE hFile, void *buffer, DWORD size) {
+    char *p = (char *)buffer;
+    while (size) {
+        DWORD got = 0;
+        if (!ReadFile(hFile, p, size, &got, NULL))
+            return 0;
+        if (!got) {
+            SetLastError(ERROR_HANDLE_EOF);
+            return 0;
+        }
+        p += got;
+        size -= got;
+    }
+    return 1;
+}
+
+/* Parse a tar numeric field: octal text, or base-256 when the high bit is set */
+static ULONGLONG parseTarNumber(const unsigned char *field, size_t len) {
+    ULONGLONG value = 0;
+    if (field[0] & 0x80) {
+        value = field[0] & 0x3F;
+        for (size_t i = 1; i < len; i++)
+            value = (value << 8) | field[i];
+        return value;
+    }
+    for (size_t i = 0; i < len && (field[i] == ' ' || (field[i] >= '0' && field[i] <= '7')); i++) {
+        if (field[i] != ' ')
+            value = value * 8 + (field[i] - '0');
+    }
+    return value;
+}
+
+/* Length of a NUL-padded tar text field */
+static size_t tarFieldLength(const unsigned char *field, size_t len) {
+    const unsigned char *nul = (const unsigned char *)memchr(field, 0, len);
+    return nul ? (size_t)(nul - field) : len;
+}
+
+#define TAR_BLOCK 512
+#define TAR_MAX_META (64 * 1024)
+
+/* Read the data of a metadata member (GNU long name or pax header) into buffer */
+static int readTarMeta(HANDLE hFile, ULONGLONG size, char *buffer, size_t *length) {
+    ULONGLONG padded = (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+    LARGE_INTEGER skip;
+    if (size >= TAR_MAX_META) {
+        *length = 0;
+        skip.QuadPart = (LONGLONG)padded;
+        return SetFilePointerEx(hFile, skip, NULL, FILE_CURRENT);
+    }
+    if (!readExact(hFile, buffer, (DWORD)size))
+        return 0;
+    buffer[size] = '\0';
+    *length = (size_t)size;
+    skip.QuadPart = (LONGLONG)(padded - size);
+    return SetFilePointerEx(hFile, skip, NULL, FILE_CURRENT);
+}
+
+/* Walk tar headers, seeking past member data */
+static int scanTar(ArchiveScan *scan, HANDLE hFile) {
+    unsigned char header[TAR_BLOCK];
+    char *longName = (char *)malloc(TAR_MAX_META + 1);
+    char *paxData = (char *)malloc(TAR_MAX_META + 1);
+    if (!longName || !paxData) {
+        free(longName);
+        free(paxData);
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return 0;
+    }
+    size_t longNameLen = 0;
+    char paxPath[MAX_PATH * 2];
+    size_t paxPathLen = 0;
+    ULONGLONG paxSize = 0;
+    int havePaxSize = 0, ok = 1;
+
+    while (!scan->stopped && !scan->failed) {
+        if (!readExact(hFile, header, TAR_BLOCK)) {
+            ok = GetLastError() == ERROR_HANDLE_EOF;
+            break;
+        }
+        if (!header[0]) {
+            /* A zero block marks the end of the archive */
+            break;
+        }
+        /* Some old tar implementations summed the header as signed chars; accept either */
+        unsigned sum = 0;
+        int signedSum = 0;
+        for (int i = 0; i < TAR_BLOCK; i++) {
+            sum += (i >= 148 && i < 156) ? ' ' : header[i];
+            signedSum += (i >= 148 && i < 156) ? ' ' : (signed char)header[i];
+        }
+        const ULONGLONG expected = parseTarNumber(header + 148, 8);
+        if (sum != expected && (signedSum < 0 || (ULONGLONG)signedSum != expected)) {
+            SetLastError(ERROR_BAD_FORMAT);
+            ok = 0;
+            break;
+        }
+
+        ULONGLONG size = parseTarNumber(header + 124, 12);
+        char type = (char)header[156];
+        if (type == 'L') {
+            if (!readTarMeta(hFile, size, longName, &longNameLen)) { ok = 0; break; }
+            while (longNameLen && !longName[longNameLen - 1])
+                longNameLen--;
+            continue;
+        }
+        if (type == 'x' || type == 'g') {
+            size_t paxLen;
+            if (!readTarMeta(hFile, size, paxData, &paxLen)) { ok = 0; break; }
+            /* Records are "<length> <key>=<value>\n"; only per-file path and size matter */
+            for (size_t pos = 0; type == 'x' && pos < paxLen;) {
+                char *endPtr;
+                unsigned long recordLen = strtoul(paxData + pos, &endPtr, 10);
+                if (!recordLen || *endPtr != ' ' || pos + recordLen > paxLen)
+                    break;
+                char *key = endPtr + 1;
+                char *recordEnd = paxData + pos + recordLen - 1;
+                if (!strncmp(key, "path=", 5))
+                    paxPathLen = archiveNameToAnsi(CP_UTF8, key + 5, (size_t)(recordEnd - key - 5), paxPath, sizeof(paxPath));
+                else if (!strncmp(key, "size=", 5)) {
+                    paxSize = strtoull(key + 5, NULL, 10);
+                    havePaxSize = 1;
+                }
+                pos += recordLen;
+            }
+            continue;
+        }
+        if (type == 'K') {
+            /* GNU long link name; link targets are not listed, so paxData serves as scratch */
+            size_t linkLen;
+            if (!readTarMeta(hFile, size, paxData, &linkLen)) { ok = 0; break; }
+            continue;
+        }
+        if (type == 'V' || type == 'M' || type == 'N') {
+            /* GNU volume label, multi-volume continuation and old long names are not members */
+            LARGE_INTEGER skip;
+            skip.QuadPart = (LONGLONG)((size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK);
+            if (skip.QuadPart && !SetFilePointerEx(hFile, skip, NULL, FILE_CURRENT)) { ok = 0; break; }
+            continue;
+        }
+        if (type == 'S') {
+            /* GNU sparse file: the listed size is the real one, and extension headers precede the data */
+            for (int extended = header[482]; extended;) {
+                unsigned char block[TAR_BLOCK];
+                if (!readExact(hFile, block, TAR_BLOCK)) { ok = 0; break; }
+                extended = block[504];
+            }
+            if (!ok)
+                break;
+        }
+
+        char ustarName[256 + 2];
+        const char *name = ustarName;
+        size_t nameLen;
+        if (longNameLen) {
+            name = longName;
+            nameLen = longNameLen;
+        } else if (paxPathLen) {
+            name = paxPath;
+            nameLen = paxPathLen;
+        } else {
+            size_t prefixLen = !memcmp(header + 257, "ustar", 5) ? tarFieldLength(header + 345, 155) : 0;
+            size_t baseLen = tarFieldLength(header, 100);
+            nameLen = 0;
+            if (prefixLen) {
+                memcpy(ustarName, header + 345, prefixLen);
+                ustarName[prefixLen] = '/';
+                nameLen = prefixLen + 1;
+            }
+            memcpy(ustarName + nameLen, header, baseLen);
+            nameLen += baseLen;
+        }
+        ULONGLONG shownSize = type == 'S' ? parseTarNumber(header + 483, 12) : size;
+        if (havePaxSize)
+            size = shownSize = paxSize;
+
+        ULONGLONG seconds = parseTarNumber(header + 136, 12);
+        ULONGLONG ticks = (seconds + 11644473600ULL) * 10000000ULL;
+        FILETIME mtime = { (DWORD)ticks, (DWORD)(ticks >> 32) };
+        int isDir = type == '5' || type == 'D' || (nameLen && name[nameLen - 1] == '/');
+        DWORD attributes = (type == '2') ? FILE_ATTRIBUTE_REPARSE_POINT : 0;
+        if (nameLen)
+            archiveMember(scan, name, nameLen, isDir, (type == '2' || isDir) ? 0 : shownSize, &mtime, attributes);
+        longNameLen = paxPathLen = 0;
+        havePaxSize = 0;
+
+        /* Links, devices, directories and FIFOs carry no data blocks */
+        if (type < '1' || type > '6') {
+            LARGE_INTEGER skip;
+            skip.QuadPart = (LONGLONG)((size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK);
+            if (skip.QuadPart && !SetFilePointerEx(hFile, skip, NULL, FILE_CURRENT)) {
+                ok = 0;
+                break;
+            }
+        }
+    }
+    free(longName);
+    free(paxData);
+    return ok;
+}
+
+/* List the folder inner of an archive file through the normal entry pipeline */
+static int enumerateArchive(const LkOptions *options, const char *restrict directory, const char *restrict wildcard,
+                            ArchiveKind kind, const char *restrict archivePath, const char *restrict inner,
+                            LkEntryCallback callback, void *context) {
+    ArchiveScan scan;
+    memset(&scan, 0, sizeof(scan));
+    scan.options = options;
+    scan.directory = directory;
+    scan.wildcard = wildcard;
+    scan.callback = callback;
+    scan.context = context;
+
+    /* Inner folder with '/' separators and a trailing '/' */
+    size_t innerLen = strlen(inner);
+    while (innerLen && (inner[innerLen - 1] == '\\' || inner[innerLen - 1] == '/'))
+        innerLen--;
+    if (innerLen + 2 > sizeof(scan.prefix)) {
+        SetLastError(ERROR_FILENAME_EXCED_RANGE);
+        return 0;
+    }
+    for (size_t i = 0; i < innerLen; i++)
+        scan.prefix[i] = inner[i] == '\\' ? '/' : inner[i];
+    if (innerLen)
+        scan.prefix[innerLen++] = '/';
+    scan.prefix[innerLen] = '\0';
+    scan.prefixLen = innerLen;
+
+    /* A cached archive is listed from its member table without touching the file */
+    LkArchiveCache *cache = options->archiveCache;
+    struct LkArchiveTable *table = cache ? findArchiveTable(cache, archivePath) : NULL;
+    int ok = 1, cached = table != NULL;
+    DWORD err = 0;
+    if (!table) {
+        HANDLE hFile = CreateFileA(archivePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                   kind == ARCHIVE_TAR ? FILE_FLAG_SEQUENTIAL_SCAN : 0, NULL);
+        if (hFile == INVALID_HANDLE_VALUE)
+            return 0;
+        BY_HANDLE_FILE_INFORMATION info;
+        LARGE_INTEGER fileSize;
+        if (!GetFileInformationByHandle(hFile, &info) || !GetFileSizeEx(hFile, &fileSize)) {
+            err = GetLastError();
+            CloseHandle(hFile);
+            SetLastError(err);
+            return 0;
+        }
+        scan.archiveTime = info.ftLastWriteTime;
+        /* With a cache the whole archive is recorded first, then listed from the table */
+        if (cache && (table = (struct LkArchiveTable *)calloc(1, sizeof(*table))) != NULL) {
+            strcpy(table->path, archivePath);
+            table->archiveTime = info.ftLastWriteTime;
+            scan.record = table;
+        }
+        ok = kind == ARCHIVE_ZIP ? scanZip(&scan, hFile, (ULONGLONG)fileSize.QuadPart) : scanTar(&scan, hFile);
+        err = GetLastError();
+        CloseHandle(hFile);
+        scan.record = NULL;
+        cached = table && ok && !scan.failed && addArchiveTable(cache, table);
+    }
+    if (table) {
+        /* Members recorded before a read error are still listed, as a direct scan would have */
+        scan.archiveTime = table->archiveTime;
+        for (size_t i = 0; i < table->count && !scan.stopped && !scan.failed; i++) {
+            const ArchiveRecord *member = &table->records[i];
+            archiveMember(&scan, table->names + member->nameOffset, member->nameLen, member->isDir,
+                          member->size, &member->mtime, member->attributes);
+        }
+        if (!cached)
+            freeArchiveTable(table);
+    }
+    nameSetFree(&scan.folders);
+    if (scan.failed) {
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return 0;
+    }
+    SetLastError(err);
+    return ok;
+}
+
+/*
+ * Enumerate through GetFileInformationByHandleEx(FileIdBothDirectoryInfo), which returns
+ * the same metadata as FindFirstFile plus each entry's file ID in one pass.
+ * Returns -1, having delivered nothing, when the file system does not support it.
+ */
+static int enumerateWithIds(const LkOptions *options, const char *restrict directory, const char *restrict wildcard,
+                            LkEntryCallback callback, void *context) {
+    HANDLE hDir = CreateFileA(directory, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (hDir == INVALID_HANDLE_VALUE)
+        return 0;
+    /* DWORD-aligned, as the records require */
+    static const size_t bufferSize = 64 * 1024;
+    DWORD *buffer = (DWORD *)malloc(bufferSize);
+    if (!buffer) {
+        CloseHandle(hDir);
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return 0;
+    }
+
+    FileEntry entry;
+    WIN32_FIND_DATAA *findData = &entry.findData;
+    entry.flags = 0;
+    int ok = 1, more = 1, pending = 0;
+    if (!GetFileInformationByHandleEx(hDir, FileIdBothDirectoryInfo, buffer, (DWORD)bufferSize)) {
+        DWORD err = GetLastError();
+        free(buffer);
+        CloseHandle(hDir);
+        /* Nothing at all, not even "." and "..": a drive root or a file system that omits them */
+        if (err == ERROR_NO_MORE_FILES)
+            return 1;
+        SetLastError(err);
+        return (err == ERROR_INVALID_PARAMETER || err == ERROR_NOT_SUPPORTED) ? -1 : 0;
+    }
+    do {
+        const FILE_ID_BOTH_DIR_INFO *info = (const FILE_ID_BOTH_DIR_INFO *)buffer;
+        for (;;) {
+            if (options->throttle && ++pending == THROTTLE_BATCH) {
+                lkThrottleTake(options->throttle, pending);
+                pending = 0;
+            }
+            memset(&entry, 0, sizeof(entry));
+            int nameLen = WideCharToMultiByte(CP_ACP, 0, info->FileName, (int)(info->FileNameLength / sizeof(WCHAR)),
+                                              findData->cFileName, MAX_PATH - 1, NULL, NULL);
+            if (nameLen > 0) {
+                WideCharToMultiByte(CP_ACP, 0, info->ShortName, info->ShortNameLength / sizeof(WCHAR),
+                                    findData->cAlternateFileName, sizeof(findData->cAlternateFileName) - 1, NULL, NULL);
+                findData->dwFileAttributes = info->FileAttributes;
+                findData->ftCreationTime.dwLowDateTime = info->CreationTime.LowPart;
+                findData->ftCreationTime.dwHighDateTime = (DWORD)info->CreationTime.HighPart;
+                findData->ftLastAccessTime.dwLowDateTime = info->LastAccessTime.LowPart;
+                findData->ftLastAccessTime.dwHighDateTime = (DWORD)info->LastAccessTime.HighPart;
+                findData->ftLastWriteTime.dwLowDateTime = info->LastWriteTime.LowPart;
+                findData->ftLastWriteTime.dwHighDateTime = (DWORD)info->LastWriteTime.HighPart;
+                findData->nFileSizeLow = info->EndOfFile.LowPart;
+                findData->nFileSizeHigh = (DWORD)info->EndOfFile.HighPart;
+                /* For reparse points EaSize holds the reparse tag, as dwReserved0 does for FindFirstFile */
+                if (info->FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+                    findData->dwReserved0 = info->EaSize;
+                entry.fileId = (ULONGLONG)info->FileId.QuadPart;
+                if (!deliverEntry(options, directory, wildcard, &entry, callback, context)) {
+                    more = 0;
+                    break;
+                }
+            }
+            if (!info->NextEntryOffset)
+                break;
+            info = (const FILE_ID_BOTH_DIR_INFO *)((const char *)info + info->NextEntryOffset);
+        }
+    } while (more && GetFileInformationByHandleEx(hDir, FileIdBothDirectoryInfo, buffer, (DWORD)bufferSize));
+    if (more && GetLastError() != ERROR_NO_MORE_FILES)
+        ok = 0;
+    DWORD err = GetLastError();
+    lkThrottleTake(options->throttle, pending);
+    free(buffer);
+    CloseHandle(hDir);
+    SetLastError(err);
+    return ok;
+}
+
+/* lkEnumerateDirectory without the concurrency limit */
+static int enumerateDirectory(const LkOptions *options, const char *restrict path, LkEntryCallback callback, void *context) {
+    char directory[MAX_PATH] = {0};
+    char wildcard[256] = {0};
+    int hasWildcard = (strchr(path, '*') || strchr(path, '?'));
+
+    if (hasWildcard) {
+        const char *sep = strrchr(path, '\\');
+        if (!sep) sep = strrchr(path, '/');
+        if (sep) {
+            size_t dirLen = sep - path;
+            if (dirLen >= MAX_PATH || strlen(sep + 1) >= sizeof(wildcard)) {
+                SetLastError(ERROR_FILENAME_EXCED_RANGE);
+                return 0;
+            }
+            memcpy(directory, path, dirLen);
+            directory[dirLen] = '\0';
+            strcpy(wildcard, sep + 1);
+        } else {
+            if (strlen(path) >= sizeof(wildcard)) {
+                SetLastError(ERROR_FILENAME_EXCED_RANGE);
+                return 0;
+            }
+            strcpy(directory, ".");
+            strcpy(wildcard, path);
+        }
+    } else {
+        size_t pathLen = strlen(path);
+        if (pathLen >= MAX_PATH) {
+            SetLastError(ERROR_FILENAME_EXCED_RANGE);
+            return 0;
+        }
+        memcpy(directory, path, pathLen);
+        directory[pathLen] = '\0';
+        /* Apply the filter pattern from options if specified */
+        if (options->filterPattern[0]) {
+            strncpy(wildcard, options->filterPattern, sizeof(wildcard) - 1);
+            wildcard[sizeof(wildcard) - 1] = '\0';
+        }
+    }
+
+    char archivePath[MAX_PATH];
+    const char *inner;
+    ArchiveKind kind = findArchive(directory, archivePath, &inner);
+    if (kind != ARCHIVE_NONE)
+        return enumerateArchive(options, directory, wildcard, kind, archivePath, inner, callback, context);
+    if (options->inodeOrder) {
+        int result = enumerateWithIds(options, directory, wildcard, callback, context);
+        if (result >= 0)
+            return result;
+    }
+
+    char searchPath[MAX_PATH];
+    size_t dirLen = strlen(directory);
+    int written;
+    if (dirLen > 0 && directory[dirLen - 1] != '\\')
+        written = snprintf(searchPath, sizeof(searchPath), "%s\\*", directory);
+    else
+        written = snprintf(searchPath, sizeof(searchPath), "%s*", directory);
+    if (written < 0 || (size_t)written >= sizeof(searchPath)) {
+        SetLastError(ERROR_FILENAME_EXCED_RANGE);
+        return 0;
+    }
+
+    FileEntry entry;
+    WIN32_FIND_DATAA *findData = &entry.findData;
+    entry.flags = 0;
+    entry.fileId = 0;
+    HANDLE hFind = FindFirstFileExA(
+        searchPath,
+        FindExInfoBasic,         /* Use basic info for performance */
+        findData,
+        FindExSearchNameMatch,
+        NULL,
+        FIND_FIRST_EX_LARGE_FETCH /* Optimize for large directories */
+    );
+    if (hFind == INVALID_HANDLE_VALUE)
+        return 0;
+
+    int pending = 0;
+    do {
+        if (options->throttle && ++pending == THROTTLE_BATCH) {
+            lkThrottleTake(options->throttle, pending);
+            pending = 0;
+        }
+        if (!deliverEntry(options, directory, wildcard, &entry, callback, context))
+            break;
+    } while (FindNextFileA(hFind, findData));
+
+    FindClose(hFind);
+    lkThrottleTake(options->throttle, pending);
+    return 1;
+}
+
+/*
+ * lkEnumerateDirectory: Streams the entries of path to callback without copying them.
+ * A trailing wildcard component in path ("dir\*.txt") filters by name; otherwise
+ * options->filterPattern does. Hidden entries are skipped unless options->showAll.
+ * A path through a .zip or .tar file ("build.zip\bin") lists that folder of the archive.
+ * With options->inodeOrder, entries also carry their file ID where the volume reports one.
+ * With options->throttle, opening the directory and every entry read cost a token, and
+ * the call waits for a free slot when the concurrency limit is reached.
+ * Entries arrive in file system order; use lkReadDirectory + lkSortFileList for sorted output.
+ */
+int lkEnumerateDirectory(const LkOptions *options, const char *restrict path, LkEntryCallback callback, void *context) {
+    LkThrottle *throttle = options->throttle;
+    if (!throttle)
+        return enumerateDirectory(options, path, callback, context);
+    if (throttle->slots)
+        WaitForSingleObject(throttle->slots, INFINITE);
+    lkThrottleTake(throttle, 1);
+    int ok = enumerateDirectory(options, path, callback, context);
+    DWORD err = GetLastError();
+    if (throttle->slots)
+        ReleaseSemaphore(throttle->slots, 1, NULL);
+    SetLastError(err);
+    return ok;
+}
+
+/* Callback state for lkReadDirectory; remembers a failed append */
+typedef struct {
+    FileList *list;
+    int failed;
+} CollectContext;
+
+static int collectEntry(void *context, const FileEntry *entry) {
+    CollectContext *collect = (CollectContext *)context;
+    if (UNLIKELY(!lkAddFileEntry(collect->list, entry))) {
+        collect->failed = 1;
+        return 0;
+    }
+    return 1;
+}
+
+/* Append the filtered entries of path to list (unsorted) */
+int lkReadDirectory(const LkOptions *options, const char *restrict path, FileList *list) {
+    CollectContext collect = { list, 0 };
+    if (!lkEnumerateDirectory(options, path, collectEntry, &collect))
+        return 0;
+    if (collect.failed) {
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return 0;
+    }
+    return 1;
+}
+
+/* FILETIME ticks (100 ns) per day */
+#define TICKS_PER_DAY (864000000000ULL)
+
+/* Number of significant bits in value; 0 for 0 */
+static inline int bitLength(ULONGLONG value) {
+#if defined(__GNUC__)
+    return value ? 64 - __builtin_clzll(value) : 0;
+#else
+    int bits = 0;
+    while (value) { value >>= 1; bits++; }
+    return bits;
+#endif
+}
+
+/* Reset stats; ages are measured relative to now */
+void lkStatsInit(LkStats *stats, const FILETIME *now) {
+    memset(stats, 0, sizeof(*stats));
+    stats->now = (((ULONGLONG)now->dwHighDateTime) << 32) | now->dwLowDateTime;
+}
+
+/* Find or claim the slot for ext; NULL once the table is three quarters full */
+static LkExtStat *findExtSlot(LkStats *stats, const char *ext) {
+    ULONGLONG hash = 1469598103934665603ULL;   /* FNV-1a */
+    for (const char *p = ext; *p; p++)
+        hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+    size_t index = (size_t)hash & (LK_EXT_SLOTS - 1);
+    for (;;) {
+        LkExtStat *slot = &stats->exts[index];
+        if (!slot->files) {
+            if (stats->extCount >= LK_EXT_SLOTS * 3 / 4)
+                return NULL;
+            strcpy(slot->ext, ext);
+            stats->extCount++;
+            return slot;
+        }
+        if (!strcmp(slot->ext, ext))
+            return slot;
+        index = (index + 1) & (LK_EXT_SLOTS - 1);
+    }
+}
+
+static void addExtension(LkStats *stats, const char *ext, ULONGLONG files, ULONGLONG bytes) {
+    LkExtStat *slot = ext ? findExtSlot(stats, ext) : NULL;
+    if (slot) {
+        slot->files += files;
+        slot->bytes += bytes;
+    } else {
+        stats->otherExtFiles += files;
+        stats->otherExtBytes += bytes;
+    }
+}
+
+/* Count one file in the totals, size histogram, age distribution and extension table */
+void lkStatsAddFile(LkStats *stats, const FileEntry *entry) {
+    const WIN32_FIND_DATAA *data = &entry->findData;
+    ULONGLONG size = (((ULONGLONG)data->nFileSizeHigh) << 32) | data->nFileSizeLow;
+    ULONGLONG mtime = (((ULONGLONG)data->ftLastWriteTime.dwHighDateTime) << 32) |
+                      data->ftLastWriteTime.dwLowDateTime;
+
+    stats->files++;
+    stats->bytes += size;
+
+    int bucket = bitLength(size);
+    stats->sizeFiles[bucket]++;
+    stats->sizeBytes[bucket] += size;
+
+    static const ULONGLONG ageLimits[LK_AGE_BUCKETS - 1] = {
+        TICKS_PER_DAY, 7 * TICKS_PER_DAY, 30 * TICKS_PER_DAY,
+        365 * TICKS_PER_DAY, 5 * 365 * TICKS_PER_DAY
+    };
+    ULONGLONG age = stats->now > mtime ? stats->now - mtime : 0;
+    int ageBucket = 0;
+    while (ageBucket < LK_AGE_BUCKETS - 1 && age >= ageLimits[ageBucket])
+        ageBucket++;
+    stats->ageFiles[ageBucket]++;
+    stats->ageBytes[ageBucket] += size;
+
+    /* Lowercased extension; dot files such as ".gitignore" have none */
+    char ext[LK_EXT_LEN];
+    const char *dot = strrchr(data->cFileName, '.');
+    const char *key = ext;
+    if (!dot || dot == data->cFileName) {
+        ext[0] = '\0';
+    } else if (strlen(dot + 1) >= LK_EXT_LEN) {
+        key = NULL;
+    } else {
+        size_t i = 0;
+        for (const char *p = dot + 1; *p; p++)
+            ext[i++] = (char)fast_tolower((unsigned char)*p);
+        ext[i] = '\0';
+    }
+    addExtension(stats, key, 1, size);
+}
+
+/* Offer a directory to the largest-directories min-heap */
+void lkStatsAddDirectory(LkStats *stats, const char *restrict path, ULONGLONG files, ULONGLONG bytes) {
+    LkDirStat *heap = stats->topDirs;
+    size_t i;
+    if (stats->topDirCount < LK_TOP_DIRS) {
+        /* Sift up from the new leaf */
+        i = stats->topDirCount++;
+        while (i > 0 && heap[(i - 1) / 2].bytes > bytes) {
+            heap[i] = heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+    } else {
+        if (bytes <= heap[0].bytes)
+            return;
+        /* Replace the smallest and sift down */
+        i = 0;
+        for (;;) {
+            size_t child = 2 * i + 1;
+            if (child >= LK_TOP_DIRS)
+                break;
+            if (child + 1 < LK_TOP_DIRS && heap[child + 1].bytes < heap[child].bytes)
+                child++;
+            if (heap[child].bytes >= bytes)
+                break;
+            heap[i] = heap[child];
+            i = child;
+        }
+    }
+    strncpy(heap[i].path, path, MAX_PATH - 1);
+    heap[i].path[MAX_PATH - 1] = '\0';
+    heap[i].files = files;
+    heap[i].bytes = bytes;
+}
+
+/* Fold src into dst; dst keeps its own reference time */
+void lkStatsMerge(LkStats *dst, const LkStats *src) {
+    dst->files += src->files;
+    dst->dirs += src->dirs;
+    dst->bytes += src->bytes;
+    dst->unreadable += src->unreadable;
+    for (int i = 0; i < LK_SIZE_BUCKETS; i++) {
+        dst->sizeFiles[i] += src->sizeFiles[i];
+        dst->sizeBytes[i] += src->sizeBytes[i];
+    }
+    for (int i = 0; i < LK_AGE_BUCKETS; i++) {
+        dst->ageFiles[i] += src->ageFiles[i];
+        dst->ageBytes[i] += src->ageBytes[i];
+    }
+    dst->otherExtFiles += src->otherExtFiles;
+    dst->otherExtBytes += src->otherExtBytes;
+    for (size_t i = 0; i < LK_EXT_SLOTS; i++) {
+        if (src->exts[i].files)
+            addExtension(dst, src->exts[i].ext, src->exts[i].files, src->exts[i].bytes);
+    }
+    for (size_t i = 0; i < src->topDirCount; i++)
+        lkStatsAddDirectory(dst, src->topDirs[i].path, src->topDirs[i].files, src->topDirs[i].bytes);
+}
+
+/*
+ * Git status without running git.
+ * The index is mapped read-only once per repository and each listed entry is looked
+ * up by path. A tracked file is clean when the size and mtime cached in the index equal
+ * the ones already present in the find data, so clean files are never opened; any other
+ * tracked file is reported as modified. This is the stat check git itself performs before
+ * it falls back to hashing, without the fallback.
+ */
+static inline DWORD readBE16(const unsigned char *p) { return ((DWORD)p[0] << 8) | p[1]; }
+static inline DWORD readBE32(const unsigned char *p) { return (readBE16(p) << 16) | readBE16(p + 2); }
+
+#define GIT_ENTRY_FIXED  62         /* Stat data, object id and flags before the name */
+#define GIT_MODE_TYPE    0170000
+#define GIT_MODE_SYMLINK 0120000
+#define GIT_MODE_GITLINK 0160000
+
+/* Slot holding path in a table of items: either its match or the empty slot where it belongs */
+static DWORD *gitTableFind(DWORD *slots, size_t capacity, const LkGitEntry *items, const char *restrict path, size_t len) {
+    size_t i = (size_t)hashPath(path, len) & (capacity - 1);
+    while (slots[i]) {
+        const LkGitEntry *item = &items[slots[i] - 1];
+        if (item->pathLen == len && !_strnicmp(item->path, path, len))
+            break;
+        i = (i + 1) & (capacity - 1);
+    }
+    return &slots[i];
+}
+
+/* Rehash count items into a table of newCapacity slots */
+static int gitTableResize(DWORD **slots, size_t *capacity, const LkGitEntry *items, size_t count, size_t newCapacity) {
+    DWORD *newSlots = (DWORD *)calloc(newCapacity, sizeof(DWORD));
+    if (!newSlots) {
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return 0;
+    }
+    for (size_t i = 0; i < count; i++)
+        *gitTableFind(newSlots, newCapacity, items, items[i].path, items[i].pathLen) = (DWORD)(i + 1);
+    free(*slots);
+    *slots = newSlots;
+    *capacity = newCapacity;
+    return 1;
+}
+
+static const LkGitEntry *gitLookup(const DWORD *slots, size_t capacity, const LkGitEntry *items, const char *restrict path, size_t len) {
+    if (!capacity)
+        return NULL;
+    DWORD slot = *gitTableFind((DWORD *)slots, capacity, items, path, len);
+    return slot ? &items[slot - 1] : NULL;
+}
+
+/* Record every directory that contains the tracked path; siblings stop at the first lookup */
+static int gitAddDirectories(LkGitRepo *repo, const LkGitEntry *entry) {
+    for (DWORD len = entry->pathLen; len-- > 0;) {
+        if (entry->path[len] != '/')
+            continue;
+        /* The table stays at most half full; dirs holds capacity / 2 items */
+        if ((repo->dirCount + 1) * 2 > repo->dirCapacity) {
+            size_t capacity = repo->dirCapacity ? repo->dirCapacity * 2 : 64;
+            LkGitEntry *dirs = (LkGitEntry *)realloc(repo->dirs, capacity / 2 * sizeof(LkGitEntry));
+            if (!dirs) {
+                SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+                return 0;
+            }
+            repo->dirs = dirs;
+            if (!gitTableResize(&repo->dirSlots, &repo->dirCapacity, repo->dirs, repo->dirCount, capacity))
+                return 0;
+        }
+        DWORD *slot = gitTableFind(repo->dirSlots, repo->dirCapacity, repo->dirs, entry->path, len);
+        if (*slot)
+            break;   /* Its parents were added with it */
+        LkGitEntry *dir = &repo->dirs[repo->dirCount++];
+        memset(dir, 0, sizeof(*dir));
+        dir->path = entry->path;
+        dir->pathLen = len;
+        *slot = (DWORD)repo->dirCount;
+    }
+    return 1;
+}
+
+/*
+ * Locate the name of the index entry at e. For version 4, strip is the number of
+ * bytes to drop from the previous name before appending the returned suffix.
+ */
+static int gitEntryName(const unsigned char *e, const unsigned char *end, DWORD version,
+                        size_t *strip, const char **name, size_t *nameLen, const unsigned char **next) {
+    if (end - e < GIT_ENTRY_FIXED + 1)
+        return 0;
+    size_t offset = GIT_ENTRY_FIXED;
+    if (version >= 3 && (readBE16(e + 60) & 0x4000))
+        offset += 2;
+    const unsigned char *q = e + offset;
+    *strip = 0;
+    if (version == 4) {
+        /* Offset-encoded varint, as written by git's encode_varint */
+        if (q >= end)
+            return 0;
+        size_t value = *q & 0x7F;
+        while (*q++ & 0x80) {
+            if (q >= end || value > ((size_t)-1 >> 8))
+                return 0;
+            value = ((value + 1) << 7) | (*q & 0x7F);
+        }
+        *strip = value;
+    }
+    if (q >= end)
+        return 0;
+    const unsigned char *nul = (const unsigned char *)memchr(q, 0, (size_t)(end - q));
+    if (!nul)
+        return 0;
+    *name = (const char *)q;
+    *nameLen = (size_t)(nul - q);
+    /* Versions 2 and 3 pad each entry with 1-8 NULs to a multiple of eight bytes */
+    *next = version == 4 ? nul + 1 : e + ((offset + *nameLen + 8) & ~(size_t)7);
+    return *next <= end;
+}
+
+/* Build the entry array and lookup tables from the mapped index */
+static int parseGitIndex(LkGitRepo *repo, size_t size) {
+    const unsigned char *p = repo->view;
+    const unsigned char *end = p + size;
+    if (size < 12 || memcmp(p, "DIRC", 4)) {
+        SetLastError(ERROR_BAD_FORMAT);
+        return 0;
+    }
+    DWORD version = readBE32(p + 4);
+    size_t count = readBE32(p + 8);
+    /* Every entry needs at least GIT_ENTRY_FIXED bytes, which bounds count before allocating */
+    if (version < 2 || version > 4 || count > (size - 12) / GIT_ENTRY_FIXED) {
+        SetLastError(ERROR_BAD_FORMAT);
+        return 0;
+    }
+
+    size_t strip, nameLen;
+    const char *name;
+    const unsigned char *e, *next;
+    if (version == 4) {
+        /* Prefix-compressed names: measure the expanded names, then build them in one arena */
+        size_t total = 0, prevLen = 0;
+        e = p + 12;
+        for (size_t i = 0; i < count; i++, e = next) {
+            if (!gitEntryName(e, end, version, &strip, &name, &nameLen, &next) || strip > prevLen) {
+                SetLastError(ERROR_BAD_FORMAT);
+                return 0;
+            }
+            prevLen = prevLen - strip + nameLen;
+            total += prevLen;
+        }
+        repo->names = (char *)malloc(total + 1);
+        if (!repo->names) {
+            SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+            return 0;
+        }
+    }
+
+    repo->entries = (LkGitEntry *)calloc(count ? count : 1, sizeof(LkGitEntry));
+    repo->fileCapacity = 16;
+    while (repo->fileCapacity < count * 2)
+        repo->fileCapacity *= 2;
+    repo->fileSlots = (DWORD *)calloc(repo->fileCapacity, sizeof(DWORD));
+    if (!repo->entries || !repo->fileSlots) {
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return 0;
+    }
+
+    char *arena = repo->names;
+    const char *prev = NULL;
+    size_t prevLen = 0;
+    e = p + 12;
+    for (size_t i = 0; i < count; i++, e = next) {
+        if (!gitEntryName(e, end, version, &strip, &name, &nameLen, &next)) {
+            SetLastError(ERROR_BAD_FORMAT);
+            return 0;
+        }
+        if (version == 4) {
+            if (prevLen > strip)
+                memcpy(arena, prev, prevLen - strip);
+            memcpy(arena + prevLen - strip, name, nameLen);
+            nameLen += prevLen - strip;
+            name = arena;
+            arena += nameLen;
+            prev = name;
+            prevLen = nameLen;
+        }
+        DWORD flags = readBE16(e + 60);
+        LkGitEntry *entry = &repo->entries[repo->entryCount];
+        entry->path = name;
+        entry->pathLen = (DWORD)nameLen;
+        entry->stat = e;
+        entry->flags = (flags & 0x3000) ? LK_GIT_ENTRY_CONFLICT : 0;
+        if ((flags & 0x8000) || (version >= 3 && (flags & 0x4000) && (readBE16(e + 62) & 0x4000)))
+            entry->flags |= LK_GIT_ENTRY_UNCHANGED;
+
+        DWORD *slot = gitTableFind(repo->fileSlots, repo->fileCapacity, repo->entries, name, nameLen);
+        if (*slot) {
+            /* Another stage of the same path */
+            repo->entries[*slot - 1].flags |= LK_GIT_ENTRY_CONFLICT;
+            continue;
+        }
+        *slot = (DWORD)++repo->entryCount;
+        if (!gitAddDirectories(repo, entry))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * lkGitFindRoot: Walk up from directory to the nearest work tree, i.e. the nearest
+ * directory holding a ".git" directory or file. Fails with ERROR_FILE_NOT_FOUND.
+ */
+int lkGitFindRoot(const char *restrict directory, char *restrict root, size_t size) {
+    char path[MAX_PATH];
+    size_t len = strlen(directory);
+    if (len + sizeof("\\.git") > sizeof(path)) {
+        SetLastError(ERROR_FILENAME_EXCED_RANGE);
+        return 0;
+    }
+    memcpy(path, directory, len + 1);
+    while (len && (path[len - 1] == '\\' || path[len - 1] == '/'))
+        len--;
+    while (len) {
+        memcpy(path + len, "\\.git", sizeof("\\.git"));
+        if (GetFileAttributesA(path) != INVALID_FILE_ATTRIBUTES) {
+            if (len >= size) {
+                SetLastError(ERROR_INSUFFICIENT_BUFFER);
+                return 0;
+            }
+            memcpy(root, path, len);
+            root[len] = '\0';
+            return 1;
+        }
+        /* Step up one component */
+        while (len && path[len - 1] != '\\' && path[len - 1] != '/')
+            len--;
+        while (len && (path[len - 1] == '\\' || path[len - 1] == '/'))
+            len--;
+    }
+    SetLastError(ERROR_FILE_NOT_FOUND);
+    return 0;
+}
+
+/* Resolve a ".git" file ("gitdir: <path>", used by worktrees and submodules) into repo->gitDir */
+static int readGitLink(LkGitRepo *repo) {
+    HANDLE hFile = CreateFileA(repo->gitDir, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                               OPEN_EXISTING, 0, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return 0;
+    char text[MAX_PATH + 16];
+    DWORD got = 0;
+    BOOL ok = ReadFile(hFile, text, sizeof(text) - 1, &got, NULL);
+    CloseHandle(hFile);
+    if (!ok)
+        return 0;
+    text[got] = '\0';
+    text[strcspn(text, "\r\n")] = '\0';
+    if (strncmp(text, "gitdir: ", 8)) {
+        SetLastError(ERROR_BAD_FORMAT);
+        return 0;
+    }
+    const char *target = text + 8;
+    char joined[MAX_PATH];
+    int absolute = target[0] == '/' || target[0] == '\\' || (target[0] && target[1] == ':');
+    if (!absolute) {
+        if (!lkJoinPath(repo->root, target, joined, sizeof(joined)))
+            return 0;
+        target = joined;
+    }
+    DWORD len = GetFullPathNameA(target, MAX_PATH, repo->gitDir, NULL);
+    if (!len || len >= MAX_PATH) {
+        SetLastError(ERROR_FILENAME_EXCED_RANGE);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * lkGitOpenRepo: Map the index of the work tree at root and index its paths.
+ * A repository without an index yet opens with no tracked entries.
+ */
+int lkGitOpenRepo(LkGitRepo *repo, const char *restrict root) {
+    memset(repo, 0, sizeof(*repo));
+    size_t rootLen = strlen(root);
+    if (rootLen >= sizeof(repo->root)) {
+        SetLastError(ERROR_FILENAME_EXCED_RANGE);
+        return 0;
+    }
+    memcpy(repo->root, root, rootLen + 1);
+    if (!lkJoinPath(root, ".git", repo->gitDir, sizeof(repo->gitDir)))
+        return 0;
+    DWORD attr = GetFileAttributesA(repo->gitDir);
+    if (attr == INVALID_FILE_ATTRIBUTES)
+        return 0;
+    if (!(attr & FILE_ATTRIBUTE_DIRECTORY) && !readGitLink(repo))
+        return 0;
+
+    char indexPath[MAX_PATH];
+    if (!lkJoinPath(repo->gitDir, "index", indexPath, sizeof(indexPath)))
+        return 0;
+    HANDLE hFile = CreateFileA(indexPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                               NULL, OPEN_EXISTING, 0, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return GetLastError() == ERROR_FILE_NOT_FOUND;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(hFile, &size) || (ULONGLONG)size.QuadPart > (SIZE_T)-1 / 2) {
+        DWORD err = GetLastError();
+        CloseHandle(hFile);
+        SetLastError(err ? err : ERROR_NOT_ENOUGH_MEMORY);
+        return 0;
+    }
+    if (size.QuadPart == 0) {
+        CloseHandle(hFile);
+        return 1;
+    }
+    /* The mapping keeps the file open, so the handle can go now */
+    repo->hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(hFile);
+    if (!repo->hMapping)
+        return 0;
+    repo->view = (const unsigned char *)MapViewOfFile(repo->hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (!repo->view || !parseGitIndex(repo, (size_t)size.QuadPart)) {
+        DWORD err = GetLastError();
+        lkGitCloseRepo(repo);
+        SetLastError(err);
+        return 0;
+    }
+    return 1;
+}
+
+void lkGitCloseRepo(LkGitRepo *repo) {
+    if (repo->view)
+        UnmapViewOfFile(repo->view);
+    if (repo->hMapping)
+        CloseHandle(repo->hMapping);
+    free(repo->names);
+    free(repo->entries);
+    free(repo->fileSlots);
+    free(repo->dirs);
+    free(repo->dirSlots);
+    free(repo->checked);
+    memset(repo, 0, sizeof(*repo));
+}
+
+/* Glob for ignore rules: '*' and '?' stop at '/', "**" crosses directories, [...] classes; ignores case */
+static int gitGlob(const char *restrict p, const char *restrict s) {
+    for (;; p++, s++) {
+        switch (*p) {
+        case '\0':
+            return !*s;
+        case '*':
+            if (p[1] == '*') {
+                p += 2;
+                /* A double star followed by a slash may also match no directory at all */
+                if (*p == '/' && gitGlob(p + 1, s))
+                    return 1;
+                for (;; s++) {
+                    if (gitGlob(p, s))
+                        return 1;
+                    if (!*s)
+                        return 0;
+                }
+            }
+            for (p++;; s++) {
+                if (gitGlob(p, s))
+                    return 1;
+                if (!*s || *s == '/')
+                    return 0;
+            }
+        case '?':
+            if (!*s || *s == '/')
+                return 0;
+            break;
+        case '[': {
+            if (!*s || *s == '/')
+                return 0;
+            const char *q = p + 1;
+            int negate = (*q == '!' || *q == '^');
+            int matched = 0, c = fast_tolower((unsigned char)*s);
+            q += negate;
+            /* A ']' right after the '[' is literal */
+            do {
+                int lo = (unsigned char)*q;
+                if (lo == '\\' && q[1])
+                    lo = (unsigned char)*++q;
+                if (!lo)
+                    return 0;
+                int hi = lo;
+                if (q[1] == '-' && q[2] && q[2] != ']') {
+                    hi = (unsigned char)q[2];
+                    q += 2;
+                }
+                q++;
+                if (c >= fast_tolower(lo) && c <= fast_tolower(hi))
+                    matched = 1;
+            } while (*q != ']');
+            if (matched == negate)
+                return 0;
+            p = q;
+            break;
+        }
+        case '\\':
+            if (p[1])
+                p++;
+            /* fall through */
+        default:
+            if (fast_tolower((unsigned char)*p) != fast_tolower((unsigned char)*s))
+                return 0;
+            break;
+        }
+    }
+}
+
+/* Does any rule ignore path (relative to the root, name starting at nameOffset)? Later rules win. */
+static int gitIgnored(const LkGitDirectory *dir, const char *restrict path, size_t nameOffset, int isDir) {
+    for (size_t i = dir->ruleCount; i-- > 0;) {
+        const LkGitRule *rule = &dir->rules[i];
+        if ((rule->flags & LK_GIT_RULE_DIR_ONLY) && !isDir)
+            continue;
+        const char *subject = (rule->flags & LK_GIT_RULE_ANCHORED) ? path + rule->baseLen : path + nameOffset;
+        if (gitGlob(rule->pattern, subject))
+            return !(rule->flags & LK_GIT_RULE_NEGATE);
+    }
+    return 0;
+}
+
+/* Append the rules of one ignore file; a missing file adds none */
+static int gitLoadIgnoreFile(LkGitDirectory *dir, const char *restrict filePath, size_t baseLen) {
+    HANDLE hFile = CreateFileA(filePath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                               NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        DWORD err = GetLastError();
+        return err == ERROR_FILE_NOT_FOUND || err == ERROR_PATH_NOT_FOUND;
+    }
+    LARGE_INTEGER size;
+    char *text = NULL;
+    char **texts = NULL;
+    DWORD got = 0;
+    int ok = GetFileSizeEx(hFile, &size) && size.QuadPart < 16 * 1024 * 1024 &&
+             (text = (char *)malloc((size_t)size.QuadPart + 1)) != NULL &&
+             (texts = (char **)realloc(dir->texts, (dir->textCount + 1) * sizeof(char *))) != NULL &&
+             ReadFile(hFile, text, (DWORD)size.QuadPart, &got, NULL);
+    CloseHandle(hFile);
+    if (texts)
+        dir->texts = texts;
+    if (!ok) {
+        free(text);
+        return 0;
+    }
+    text[got] = '\0';
+    dir->texts[dir->textCount++] = text;
+
+    for (char *line = text; line;) {
+        char *eol = strchr(line, '\n');
+        if (eol)
+            *eol++ = '\0';
+        if (line[0] == '#') {
+            line = eol;
+            continue;
+        }
+        size_t len = strlen(line);
+        /* Trailing spaces are dropped unless escaped */
+        while (len && (line[len - 1] == '\r' || (line[len - 1] == ' ' && (len < 2 || line[len - 2] != '\\'))))
+            line[--len] = '\0';
+        DWORD flags = 0;
+        if (line[0] == '!') {
+            flags |= LK_GIT_RULE_NEGATE;
+            line++;
+            len--;
+        } else if (line[0] == '\\' && (line[1] == '!' || line[1] == '#')) {
+            line++;
+            len--;
+        }
+        if (len && line[len - 1] == '/') {
+            flags |= LK_GIT_RULE_DIR_ONLY;
+            line[--len] = '\0';
+        }
+        if (memchr(line, '/', len))
+            flags |= LK_GIT_RULE_ANCHORED;
+        while (line[0] == '/') {
+            line++;
+            len--;
+        }
+        if (len) {
+            if (dir->ruleCount == dir->ruleCapacity) {
+                size_t capacity = dir->ruleCapacity ? dir->ruleCapacity * 2 : 64;
+                LkGitRule *rules = (LkGitRule *)realloc(dir->rules, capacity * sizeof(LkGitRule));
+                if (!rules) {
+                    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+                    return 0;
+                }
+                dir->rules = rules;
+                dir->ruleCapacity = capacity;
+            }
+            LkGitRule *rule = &dir->rules[dir->ruleCount++];
+            rule->pattern = line;
+            rule->baseLen = baseLen;
+            rule->flags = flags;
+        }
+        line = eol;
+    }
+    return 1;
+}
+
+/*
+ * lkGitOpenDirectory: Prepare status lookups for the entries of directory, which must
+ * lie inside repo's work tree. Loads info/exclude and every .gitignore from the root
+ * down to directory, stopping early if an ancestor is itself ignored.
+ */
+int lkGitOpenDirectory(LkGitDirectory *dir, LkGitRepo *repo, const char *restrict directory) {
+    memset(dir, 0, sizeof(*dir));
+    dir->repo = repo;
+    size_t rootLen = strlen(repo->root);
+    if (_strnicmp(directory, repo->root, rootLen) ||
+        (directory[rootLen] && directory[rootLen] != '\\' && directory[rootLen] != '/')) {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return 0;
+    }
+    const char *rel = directory + rootLen;
+    while (*rel == '\\' || *rel == '/')
+        rel++;
+    size_t len = strlen(rel);
+    while (len && (rel[len - 1] == '\\' || rel[len - 1] == '/'))
+        len--;
+    if (len + 2 > sizeof(dir->path)) {
+        SetLastError(ERROR_FILENAME_EXCED_RANGE);
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++)
+        dir->path[i] = rel[i] == '\\' ? '/' : rel[i];
+    if (len)
+        dir->path[len++] = '/';
+    dir->path[len] = '\0';
+    dir->pathLen = len;
+
+    char filePath[MAX_PATH];
+    if (!lkJoinPath(repo->gitDir, "info\\exclude", filePath, sizeof(filePath)) ||
+        !gitLoadIgnoreFile(dir, filePath, 0) ||
+        !lkJoinPath(repo->root, ".gitignore", filePath, sizeof(filePath)) ||
+        !gitLoadIgnoreFile(dir, filePath, 0)) {
+        lkGitCloseDirectory(dir);
+        return 0;
+    }
+    /* Check each component with the rules of its parents, then add its own .gitignore */
+    char component[MAX_PATH];
+    for (size_t start = 0, end; start < len; start = end + 1) {
+        end = start;
+        while (dir->path[end] != '/')
+            end++;
+        memcpy(component, dir->path, end);
+        component[end] = '\0';
+        if (gitIgnored(dir, component, start, 1)) {
+            dir->ignored = 1;
+            break;
+        }
+        for (size_t i = 0; i < end; i++)
+            component[i] = component[i] == '/' ? '\\' : component[i];
+        char gitignorePath[MAX_PATH];
+        if (!lkJoinPath(repo->root, component, filePath, sizeof(filePath)) ||
+            !lkJoinPath(filePath, ".gitignore", gitignorePath, sizeof(gitignorePath)) ||
+            !gitLoadIgnoreFile(dir, gitignorePath, end + 1)) {
+            lkGitCloseDirectory(dir);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void lkGitCloseDirectory(LkGitDirectory *dir) {
+    for (size_t i = 0; i < dir->textCount; i++)
+        free(dir->texts[i]);
+    free(dir->texts);
+    free(dir->rules);
+    memset(dir, 0, sizeof(*dir));
+}
+
+/* Compare the stat data cached in an index entry with the find data */
+static int gitStatMatches(const LkGitEntry *tracked, const WIN32_FIND_DATAA *data) {
+    if ((readBE32(tracked->stat + 24) & GIT_MODE_TYPE) == GIT_MODE_SYMLINK)
+        return (data->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
+    ULONGLONG ticks = ((ULONGLONG)data->ftLastWriteTime.dwHighDateTime << 32) | data->ftLastWriteTime.dwLowDateTime;
+    ULONGLONG unixTicks = ticks - 116444736000000000ULL;
+    if (readBE32(tracked->stat + 8) != (DWORD)(unixTicks / 10000000ULL))
+        return 0;
+    /* Builds of git without nanosecond timestamps store 0 */
+    DWORD nsec = readBE32(tracked->stat + 12);
+    if (nsec && nsec != (DWORD)(unixTicks % 10000000ULL) * 100)
+        return 0;
+    /* The index keeps the size modulo 2^32 */
+    return readBE32(tracked->stat + 36) == data->nFileSizeLow;
+}
+
+/* Status of tracked entry i, stat'ing its file once per repository */
+static LkGitStatus gitTrackedStatus(LkGitRepo *repo, size_t i) {
+    const LkGitEntry *tracked = &repo->entries[i];
+    if (repo->checked[i])
+        return (LkGitStatus)repo->checked[i];
+    LkGitStatus status = LK_GIT_CLEAN;
+    if (tracked->flags & LK_GIT_ENTRY_CONFLICT) {
+        status = LK_GIT_MODIFIED;
+    } else if (!(tracked->flags & LK_GIT_ENTRY_UNCHANGED) &&
+               (readBE32(tracked->stat + 24) & GIT_MODE_TYPE) != GIT_MODE_GITLINK) {
+        char path[MAX_PATH];
+        size_t rootLen = strlen(repo->root);
+        WIN32_FILE_ATTRIBUTE_DATA info;
+        if (rootLen + 1 + tracked->pathLen >= sizeof(path)) {
+            status = LK_GIT_MODIFIED;
+        } else {
+            memcpy(path, repo->root, rootLen);
+            path[rootLen] = '\\';
+            for (DWORD k = 0; k < tracked->pathLen; k++)
+                path[rootLen + 1 + k] = tracked->path[k] == '/' ? '\\' : tracked->path[k];
+            path[rootLen + 1 + tracked->pathLen] = '\0';
+            if (!GetFileAttributesExA(path, GetFileExInfoStandard, &info)) {
+                status = LK_GIT_MODIFIED;   /* Deleted, or unreadable */
+            } else {
+                WIN32_FIND_DATAA data;
+                memset(&data, 0, sizeof(data));
+                data.dwFileAttributes = info.dwFileAttributes;
+                data.ftLastWriteTime = info.ftLastWriteTime;
+                data.nFileSizeLow = info.nFileSizeLow;
+                if ((info.dwFileAttributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_REPARSE_POINT)) ==
+                        FILE_ATTRIBUTE_DIRECTORY || !gitStatMatches(tracked, &data))
+                    status = LK_GIT_MODIFIED;
+            }
+        }
+    }
+    repo->checked[i] = (unsigned char)status;
+    return status;
+}
+
+/*
+ * Status of a directory holding tracked files: modified as soon as one tracked file
+ * below it is, as git status reports it. prefix is the directory's entry in repo->dirs,
+ * whose path has the index's own spelling, so the files below it form one run of the
+ * sorted index that is found by binary search. Without deep only the index and the
+ * results already in repo->checked are consulted; with it each unchecked file is stat'ed.
+ */
+static LkGitStatus gitTreeStatus(LkGitRepo *repo, const LkGitEntry *prefix, int deep) {
+    size_t low = 0, high = repo->entryCount;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        const LkGitEntry *entry = &repo->entries[mid];
+        size_t common = entry->pathLen < prefix->pathLen ? entry->pathLen : prefix->pathLen;
+        int cmp = memcmp(entry->path, prefix->path, common);
+        if (cmp < 0 || (cmp == 0 && entry->pathLen <= prefix->pathLen))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    for (size_t i = low; i < repo->entryCount; i++) {
+        const LkGitEntry *entry = &repo->entries[i];
+        if (entry->pathLen <= prefix->pathLen || memcmp(entry->path, prefix->path, prefix->pathLen))
+            break;
+        if (entry->path[prefix->pathLen] != '/')
+            continue;   /* A sibling such as "dir.txt" sorts between "dir" and "dir/..." */
+        if (deep ? gitTrackedStatus(repo, i) == LK_GIT_MODIFIED :
+                   (entry->flags & LK_GIT_ENTRY_CONFLICT) || repo->checked[i] == LK_GIT_MODIFIED)
+            return LK_GIT_MODIFIED;
+    }
+    return LK_GIT_CLEAN;
+}
+
+/*
+ * lkGitEntryStatus: Status of one entry of the directory opened with lkGitOpenDirectory.
+ * A tracked file is judged from its find data alone. A directory is marked modified
+ * from the index and from files of dir->repo already judged: those listed before it,
+ * or with LK_GIT_DEEP every tracked file below it, each stat'ed once per repository.
+ * Untracked files below a directory never mark it, since finding them would take a
+ * walk of the whole subtree. Every result is recorded in dir->repo, so calls sharing
+ * a repository must not run concurrently.
+ */
+LkGitStatus lkGitEntryStatus(LkGitDirectory *dir, const FileEntry *entry, DWORD flags) {
+    const WIN32_FIND_DATAA *data = &entry->findData;
+    const int isDir = (data->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    if (!_stricmp(data->cFileName, ".git"))
+        return LK_GIT_NONE;
+    if (dir->ignored)
+        return LK_GIT_IGNORED;
+
+    char path[MAX_PATH * 2];
+    size_t nameLen = strlen(data->cFileName);
+    memcpy(path, dir->path, dir->pathLen);
+    memcpy(path + dir->pathLen, data->cFileName, nameLen + 1);
+    size_t len = dir->pathLen + nameLen;
+
+    LkGitRepo *repo = dir->repo;
+    if (!repo->checked && repo->entryCount) {
+        repo->checked = (unsigned char *)calloc(repo->entryCount, 1);
+        if (!repo->checked)
+            return LK_GIT_NONE;
+    }
+    const LkGitEntry *tracked = gitLookup(repo->fileSlots, repo->fileCapacity, repo->entries, path, len);
+    if (tracked) {
+        if (tracked->flags & LK_GIT_ENTRY_CONFLICT)
+            return LK_GIT_MODIFIED;
+        if (isDir)   /* A submodule is clean here; a file replaced by a directory is not */
+            return (readBE32(tracked->stat + 24) & GIT_MODE_TYPE) == GIT_MODE_GITLINK ? LK_GIT_CLEAN : LK_GIT_MODIFIED;
+        LkGitStatus status = ((tracked->flags & LK_GIT_ENTRY_UNCHANGED) || gitStatMatches(tracked, data)) ?
+                             LK_GIT_CLEAN : LK_GIT_MODIFIED;
+        repo->checked[tracked - repo->entries] = (unsigned char)status;   /* As good as a stat for later rows */
+        return status;
+    }
+    const LkGitEntry *trackedDir;
+    if (isDir && (trackedDir = gitLookup(repo->dirSlots, repo->dirCapacity, repo->dirs, path, len)) != NULL)
+        return gitTreeStatus(repo, trackedDir, (flags & LK_GIT_DEEP) != 0);
+    return gitIgnored(dir, path, dir->pathLen, isDir) ? LK_GIT_IGNORED : LK_GIT_UNTRACKED;
+}
@@ -0,0 +1,313 @@
+#ifndef LIBLK_H
+#define LIBLK_H
+
+/*
+ * liblk: the enumeration, filtering, sorting and formatting core of lk.
+ *
+ * Every call takes its options explicitly and keeps no mutable global state,
+ * so the library is reentrant and may be used from several threads at once
+ * as long as each thread works on its own FileList.
+ * Functions returning int report success with 1 and failure with 0; on
+ * failure the Windows error code is available through GetLastError().
+ */
+
+/* Vista or later: GetFileInformationByHandleEx, FILE_ID_BOTH_DIR_INFO, GetTickCount64 */
+#if !defined(_WIN32_WINNT) || _WIN32_WINNT < 0x0600
+#undef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600
+#endif
+#include <windows.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LK_VERSION "1.5"
+#define LK_MAX_PRUNE_PATTERNS 32
+#define LK_MAX_PREDICATES 16
+
+/* Metadata predicates, listed from cheapest to most expensive to evaluate */
+typedef enum {
+    LK_PRED_TYPE,    // Entry kind is one of setMask (LK_TYPE_*).
+    LK_PRED_ATTR,    // All setMask attribute bits set, all clearMask bits clear.
+    LK_PRED_SIZE,    // File size compared with value; directories never match.
+    LK_PRED_NEWER,   // Last write time after value (FILETIME ticks).
+    LK_PRED_OLDER,   // Last write time before value (FILETIME ticks).
+    LK_PRED_NAME,    // Name matches pattern.
+    LK_PRED_OWNER    // Owner ("DOMAIN\\Name" or "Name") matches pattern; costs a security lookup.
+} LkPredicateKind;
+
+#define LK_TYPE_FILE 1
+#define LK_TYPE_DIR  2
+#define LK_TYPE_LINK 4
+
+typedef struct {
+    LkPredicateKind kind;
+    int compare;           // LK_PRED_SIZE: -1 smaller than, 0 equal to, 1 larger than value.
+    ULONGLONG value;
+    DWORD setMask;
+    DWORD clearMask;
+    char pattern[256];
+} LkPredicate;
+
+/*
+ * Shared pacing for enumeration: a token bucket caps the entries read from the file
+ * system per second, and a semaphore caps how many directories are enumerated at once.
+ * One LkThrottle may be shared by every thread whose options point at it.
+ */
+typedef struct {
+    CRITICAL_SECTION lock;
+    double rate;           // Entries per second (0 = unlimited).
+    double burst;          // Bucket size.
+    double tokens;         // May go negative; the caller that overdraws sleeps off the debt.
+    LONGLONG last;         // QueryPerformanceCounter value of the last refill.
+    double frequency;
+    HANDLE slots;          // Semaphore limiting concurrent enumerations (NULL = unlimited).
+} LkThrottle;
+
+/*
+ * Member tables of the archives read during one listing, so that listing several
+ * folders of the same zip or tar file parses it once instead of once per folder.
+ * Tables are kept until lkArchiveCacheFree; once LK_ARCHIVE_CACHE_SIZE archives are
+ * held, further ones are scanned without being kept. One LkArchiveCache may be shared
+ * by every thread whose options point at it.
+ */
+#define LK_ARCHIVE_CACHE_SIZE 16
+
+typedef struct {
+    CRITICAL_SECTION lock;
+    struct LkArchiveTable *tables[LK_ARCHIVE_CACHE_SIZE];
+    size_t count;
+} LkArchiveCache;
+
+/* Options structure for listing settings */
+typedef struct LkOptions {
+    int showAll;           // Show hidden files.
+    int longFormat;        // Detailed listing.
+    int recursive;         // Recursive directory listing.
+    int sortBySize;        // Sort by file size.
+    int sortByTime;        // Sort by modification time.
+    int sortByExtension;   // Sort by file extension.
+    int reverseSort;       // Reverse sort order.
+    int humanSize;         // Use human-readable sizes.
+    int fileTypeIndicator; // Append file type indicator.
+    int listDirs;          // List directory entry itself.
+    int groupDirs;         // Group directories first.
+    int showCreationTime;  // Display file creation time.
+    int treeView;          // Tree view of directory.
+    int naturalSort;       // Use natural sorting.
+    int showFullPath;      // Show full file path.
+    int showOwner;         // Display file owner.
+    int showSummary;       // Show summary info.
+    char filterPattern[256]; // Filename filter (empty = no filter).
+    int maxDepth;          // Levels below the root that recursion may open (-1 = unlimited).
+    int pruneCount;        // Number of prunePatterns in use.
+    const char *prunePatterns[LK_MAX_PRUNE_PATTERNS]; // Directory name globs never descended into (not owned).
+    int predicateCount;    // Number of predicates in use; all must match.
+    LkPredicate predicates[LK_MAX_PREDICATES]; // Kept in evaluation order by lkAddPredicate.
+    int inodeOrder;        // Read file IDs so callers can fetch metadata in on-disk order.
+    LkThrottle *throttle;  // Pacing applied by lkEnumerateDirectory (NULL = none; not owned).
+    LkArchiveCache *archiveCache; // Parsed archives reused across calls (NULL = read each time; not owned).
+} LkOptions;
+
+/* FileEntry flags */
+#define LK_ENTRY_TRAVERSE_ONLY 1  // Directory failed the predicates; delivered only so -R can descend.
+#define LK_ENTRY_ARCHIVE_MEMBER 2 // Listed from inside a zip or tar file; has no owner or file ID.
+
+/* Wraps WIN32_FIND_DATAA for file/directory entry */
+typedef struct {
+    WIN32_FIND_DATAA findData;
+    DWORD flags;
+    ULONGLONG fileId;      // File ID (NTFS file record number) with options->inodeOrder, else 0.
+} FileEntry;
+
+/* Dynamic array for file entries */
+typedef struct {
+    FileEntry *entries;
+    size_t count;
+    size_t capacity;
+} FileList;
+
+/* Aggregate statistics limits; an LkStats never grows beyond these */
+#define LK_SIZE_BUCKETS 65   // Bucket 0 holds empty files, bucket k sizes in [2^(k-1), 2^k).
+#define LK_AGE_BUCKETS  6    // <1 day, <1 week, <1 month, <1 year, <5 years, older.
+#define LK_EXT_SLOTS    512  // Open-addressed extension table.
+#define LK_EXT_LEN      16   // Longer extensions are counted as "other".
+#define LK_TOP_DIRS     16   // Largest directories kept.
+
+typedef struct {
+    char ext[LK_EXT_LEN];  // Lowercase extension without the dot ("" = none); empty slot when files == 0.
+    ULONGLONG files;
+    ULONGLONG bytes;
+} LkExtStat;
+
+typedef struct {
+    char path[MAX_PATH];
+    ULONGLONG files;       // Files directly inside the directory.
+    ULONGLONG bytes;       // Bytes of those files.
+} LkDirStat;
+
+/*
+ * Fixed-size streaming accumulator for --analyze style reports. Feed it entries
+ * from any number of directories; accumulators filled on different threads are
+ * combined with lkStatsMerge. Totals, histograms, ages and the largest directories
+ * merge to the same result as a single pass. Extensions only get their own slot
+ * until LK_EXT_SLOTS * 3/4 distinct ones have been seen; later ones go to the
+ * "other" bucket. Which extensions got in first depends on the order of the
+ * partials, so once a table fills up the split between named extensions and
+ * "other" can differ from a single pass. The combined counts still agree.
+ */
+typedef struct {
+    ULONGLONG now;                          // Reference time for ages, in FILETIME ticks.
+    ULONGLONG files, dirs, bytes;
+    ULONGLONG unreadable;                   // Directories that could not be enumerated.
+    ULONGLONG sizeFiles[LK_SIZE_BUCKETS];
+    ULONGLONG sizeBytes[LK_SIZE_BUCKETS];
+    ULONGLONG ageFiles[LK_AGE_BUCKETS];
+    ULONGLONG ageBytes[LK_AGE_BUCKETS];
+    ULONGLONG otherExtFiles, otherExtBytes; // Extensions too long for, or arriving after, a full exts table.
+    size_t extCount;
+    LkExtStat exts[LK_EXT_SLOTS];
+    size_t topDirCount;
+    LkDirStat topDirs[LK_TOP_DIRS];         // Min-heap on bytes.
+} LkStats;
+
+/* Git working tree status of an entry, derived from the index without reading file contents */
+typedef enum {
+    LK_GIT_NONE,       // Not inside a work tree, or the .git directory itself.
+    LK_GIT_CLEAN,      // Tracked and the index's cached size and mtime match.
+    LK_GIT_MODIFIED,   // Tracked but the cached stat data differs, or the path is conflicted.
+    LK_GIT_UNTRACKED,  // Not in the index and not ignored.
+    LK_GIT_IGNORED     // Not in the index and matched by an ignore rule.
+} LkGitStatus;
+
+#define LK_GIT_DEEP 1  // lkGitEntryStatus flag: stat the tracked files below a directory to judge it.
+
+/* One index entry; path points into the mapped index (v2/v3) or a name arena (v4) */
+typedef struct {
+    const char *path;             // '/'-separated, relative to the work tree root, not NUL-terminated for v4.
+    DWORD pathLen;
+    DWORD flags;                  // LK_GIT_ENTRY_* bits.
+    const unsigned char *stat;    // Start of the on-disk entry: big-endian ctime, mtime, ..., size.
+} LkGitEntry;
+
+#define LK_GIT_ENTRY_CONFLICT  1  // More than one merge stage is present.
+#define LK_GIT_ENTRY_UNCHANGED 2  // assume-unchanged or skip-worktree; never reported as modified.
+
+/*
+ * A work tree with its index mapped once. Paths are looked up through two
+ * open-addressed tables holding positions in entries: files, and directories
+ * that contain tracked files. Lookups ignore case, as core.ignorecase does.
+ */
+typedef struct {
+    char root[MAX_PATH];          // Work tree root, no trailing separator.
+    char gitDir[MAX_PATH];        // Repository directory (root\.git or the target of a .git file).
+    HANDLE hMapping;
+    const unsigned char *view;    // Mapped index, NULL when the repository has none yet.
+    char *names;                  // Expanded path arena for index version 4.
+    LkGitEntry *entries;
+    size_t entryCount;
+    DWORD *fileSlots;             // entries position + 1, 0 = empty.
+    size_t fileCapacity;          // Power of two.
+    LkGitEntry *dirs;             // Directory prefixes; path/pathLen only.
+    size_t dirCount;
+    DWORD *dirSlots;
+    size_t dirCapacity;
+    unsigned char *checked;       // Per entry: 0 = not judged yet, else LK_GIT_CLEAN or LK_GIT_MODIFIED.
+} LkGitRepo;
+
+/* One .gitignore / info/exclude pattern, already stripped of '!', leading and trailing '/' */
+typedef struct {
+    const char *pattern;
+    size_t baseLen;               // The rule applies below the first baseLen bytes of the directory path.
+    DWORD flags;                  // LK_GIT_RULE_* bits.
+} LkGitRule;
+
+#define LK_GIT_RULE_NEGATE   1
+#define LK_GIT_RULE_DIR_ONLY 2
+#define LK_GIT_RULE_ANCHORED 4
+
+/* Status context for listing one directory of a work tree */
+typedef struct {
+    LkGitRepo *repo;              // Not owned; lkGitEntryStatus records its results in it.
+    char path[MAX_PATH];          // Directory relative to the root, '/'-separated with a trailing '/', or "".
+    size_t pathLen;
+    int ignored;                  // The directory itself lies in an ignored directory.
+    LkGitRule *rules;             // In precedence order, lowest first.
+    size_t ruleCount, ruleCapacity;
+    char **texts;                 // Ignore file contents the rules point into.
+    size_t textCount;
+} LkGitDirectory;
+
+/*
+ * Callback invoked by lkEnumerateDirectory for every entry that passes the
+ * filters. The entry lives in the enumerator's own buffer and is only valid
+ * until the callback returns; copy it to keep it. With options->recursive set,
+ * directories that fail the predicates are still delivered, flagged
+ * LK_ENTRY_TRAVERSE_ONLY, so the caller can descend without showing them.
+ * Return nonzero to continue, zero to stop the enumeration early.
+ */
+typedef int (*LkEntryCallback)(void *context, const FileEntry *entry);
+
+/* Options */
+void lkDefaultOptions(LkOptions *options);
+
+/* FileList management */
+int lkInitFileList(FileList *list);
+int lkAddFileEntry(FileList *list, const FileEntry *entry);
+void lkFreeFileList(FileList *list);
+
+/* Enumeration and filtering */
+int lkEnumerateDirectory(const LkOptions *options, const char *path, LkEntryCallback callback, void *context);
+int lkReadDirectory(const LkOptions *options, const char *path, FileList *list);
+int lkWildcardMatch(const char *pattern, const char *str);
+
+/* Throttling */
+int lkThrottleInit(LkThrottle *throttle, double rate, int maxConcurrency);
+void lkThrottleFree(LkThrottle *throttle);
+void lkThrottleTake(LkThrottle *throttle, double count);
+
+/* Archive member tables; the cache reflects each archive as it was first read */
+void lkArchiveCacheInit(LkArchiveCache *cache);
+void lkArchiveCacheFree(LkArchiveCache *cache);
+
+/* Predicates; lkAddPredicate keeps them ordered cheapest first */
+int lkAddPredicate(LkOptions *options, const LkPredicate *predicate);
+int lkMatchPredicates(const LkOptions *options, const char *directory, const FileEntry *entry);
+int lkGetFileOwner(const char *filePath, char *owner, DWORD ownerSize);
+
+/* Recursion pruning; both are pure name/depth checks that touch no file system state */
+int lkIsPruned(const LkOptions *options, const char *name);
+int lkWithinDepth(const LkOptions *options, int depth);
+
+/* Sorting */
+int lkCompareEntries(const LkOptions *options, const FileEntry *a, const FileEntry *b);
+void lkSortFileList(const LkOptions *options, FileList *list);
+
+/* Aggregate statistics */
+void lkStatsInit(LkStats *stats, const FILETIME *now);
+void lkStatsAddFile(LkStats *stats, const FileEntry *entry);
+void lkStatsAddDirectory(LkStats *stats, const char *path, ULONGLONG files, ULONGLONG bytes);
+void lkStatsMerge(LkStats *dst, const LkStats *src);
+
+/* Git status; a repository stays mapped until lkGitCloseRepo */
+int lkGitFindRoot(const char *directory, char *root, size_t size);
+int lkGitOpenRepo(LkGitRepo *repo, const char *root);
+void lkGitCloseRepo(LkGitRepo *repo);
+int lkGitOpenDirectory(LkGitDirectory *dir, LkGitRepo *repo, const char *directory);
+void lkGitCloseDirectory(LkGitDirectory *dir);
+LkGitStatus lkGitEntryStatus(LkGitDirectory *dir, const FileEntry *entry, DWORD flags);
+
+/* Formatting */
+int lkJoinPath(const char *base, const char *child, char *result, size_t size);
+int lkFormatAttributes(DWORD attr, int isDir, char *outStr, size_t size);
+int lkFileTimeToString(const FILETIME *ft, char *buffer, size_t size);
+size_t lkFormatUnsigned(ULONGLONG value, char *buffer, size_t size);
+size_t lkFormatSize(ULONGLONG size, char *buffer, size_t bufferSize, int humanReadable);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBLK_H */
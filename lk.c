@@ -1,3 +1,8 @@
+/* Vista or later, as for liblk; also needed for PROCESS_MODE_BACKGROUND_BEGIN */
+#if !defined(_WIN32_WINNT) || _WIN32_WINNT < 0x0600
+#undef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600
+#endif
 #include <windows.h>
 #include <shellapi.h>
 #include <aclapi.h>
@@ -5,6 +10,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <stdarg.h>
+#include "liblk.h"
 
 /* Branch prediction macros for performance */
 #if defined(__GNUC__)
@@ -15,6 +25,13 @@
 #define UNLIKELY(x) (x)
 #endif
 
+/* Thread-local storage qualifier */
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
 /* Console color definitions */
 #define DEFAULT_COLOR     (FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE)   // Standard white
 #define BINARY_COLOR      (FOREGROUND_GREEN | FOREGROUND_INTENSITY)                // Executable: bright green
@@ -29,6 +46,9 @@
 #define COLOR_TIME        (FOREGROUND_RED | FOREGROUND_BLUE | FOREGROUND_INTENSITY)      // File time: magenta
 #define COLOR_OWNER       (FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY) // Owner: bright white
 #define COLOR_FULLPATH    (FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE)          // Full path: gray
+#define COLOR_GIT_MODIFIED  (FOREGROUND_RED | FOREGROUND_INTENSITY)                      // Git modified: bright red
+#define COLOR_GIT_UNTRACKED (FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_INTENSITY)   // Git untracked: yellow
+#define COLOR_GIT_IGNORED   (FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE)        // Git ignored: gray
 
 /*
  * Optimized getIndentString:
@@ -56,133 +76,236 @@ static inline const char* getIndentString(int indent) {
 // Global variable (placed at file scope)
 static int g_consoleWidth = 80; 
 
-#define INITIAL_CAPACITY 128
-
-/* Options structure for application settings */
+/* Command-line options: the liblk listing options plus the modes only the CLI implements */
 typedef struct Options {
-    int showAll;           // Show hidden files.
-    int longFormat;        // Detailed listing.
-    int recursive;         // Recursive directory listing.
-    int sortBySize;        // Sort by file size.
-    int sortByTime;        // Sort by modification time.
-    int sortByExtension;   // Sort by file extension.
-    int reverseSort;       // Reverse sort order.
-    int humanSize;         // Use human-readable sizes.
-    int fileTypeIndicator; // Append file type indicator.
-    int listDirs;          // List directory entry itself.
-    int groupDirs;         // Group directories first.
-    int showCreationTime;  // Display file creation time.
-    int treeView;          // Tree view of directory.
-    int naturalSort;       // Use natural sorting.
-    int showFullPath;      // Show full file path.
-    int showOwner;         // Display file owner.
-    int showSummary;       // Show summary info.
-    char filterPattern[256]; // Filename filter (empty = no filter).
+    LkOptions lk;          // Handed to liblk explicitly.
+    int analyze;           // Print aggregate statistics instead of a listing.
+    int diff;              // Compare two trees instead of listing them.
+    int gitStatus;         // Show each entry's git working tree status.
+    int gitDirs;           // --git-dirs: judge directory rows by stat'ing the tracked files below them.
+    int followLinks;       // Recursion also enters symlinked, junctioned and mounted directories.
+    int merge;             // List several paths as one sorted listing.
+    int estimateSeconds;   // Estimate tree totals by sampling within this many seconds (0 = off).
+    int throttleRate;      // --throttle entries per second (-1 = off, 0 = low priority only).
+    int maxConcurrency;    // --concurrency: directories enumerated at once (0 = unlimited).
 } Options;
 
-/* Global options with default values */
-static Options g_options = {
-    .showAll = 0, .longFormat = 1, .recursive = 0, .sortBySize = 0,
-    .sortByTime = 0, .sortByExtension = 0, .reverseSort = 0, .humanSize = 1,
-    .fileTypeIndicator = 1, .listDirs = 0, .groupDirs = 1, .showCreationTime = 0,
-    .treeView = 0, .naturalSort = 1, .showFullPath = 0, .showOwner = 0,
-    .showSummary = 1, .filterPattern = ""
-};
+/*
+ * Per-listing state, here and below, is thread-local: lk --serve runs each request
+ * on its own thread, and helper threads of a listing are handed what they need.
+ */
+static THREAD_LOCAL Options g_options;
 
-/* Wraps WIN32_FIND_DATAA for file/directory entry */
-typedef struct {
-    WIN32_FIND_DATAA findData;
-} FileEntry;
+/* Reset options to the defaults; the listing part comes from lkDefaultOptions */
+static void defaultOptions(Options *options) {
+    static const Options modes = {
+        .analyze = 0, .diff = 0, .gitStatus = 0, .gitDirs = 0, .followLinks = 0,
+        .merge = 0, .estimateSeconds = 0, .throttleRate = -1, .maxConcurrency = 0
+    };
+    *options = modes;
+    lkDefaultOptions(&options->lk);
+}
+
+#define LK_PIPE_PREFIX  "\\\\.\\pipe\\lk-"
+#define LK_PIPE_BUFFER  (64 * 1024)
+#define LK_MAX_REQUEST  (64 * 1024)
+#define LK_CLIENT_WAIT_MS  60000   // How long a client waits for a busy server
+
+/*
+ * Server replies are a sequence of frames: a tag byte, a DWORD length and that many
+ * bytes. Output and error text keep their own tags so the client can write each to
+ * its own handle, and the last frame carries the request's exit status as a DWORD.
+ */
+#define LK_FRAME_STDOUT 1
+#define LK_FRAME_STDERR 2
+#define LK_FRAME_EXIT   3
 
-/* Dynamic array for file entries */
+/* --serve: one client request; output is gathered in out and sent in large frames */
 typedef struct {
-    FileEntry *entries;
-    size_t count;
-    size_t capacity;
-} FileList;
+    HANDLE hPipe;
+    CRITICAL_SECTION lock;      // Analysis threads of the request may report errors too
+    volatile LONG failed;       // fatalError was called: the listing unwinds and the status is EXIT_FAILURE
+    int broken;                 // A write failed: the client is gone, the rest is dropped
+    char cwd[MAX_PATH];         // The client's working directory, for relative paths
+    size_t used;
+    char out[LK_PIPE_BUFFER];
+} Request;
+
+static THREAD_LOCAL Request *t_request = NULL;   // NULL outside --serve: output goes to stdout and stderr
+
+/* Send one frame to the client */
+static void sendFrame(Request *request, BYTE tag, const void *data, DWORD size) {
+    char header[1 + sizeof(DWORD)];
+    DWORD written;
+    if (request->broken)
+        return;
+    header[0] = (char)tag;
+    memcpy(header + 1, &size, sizeof(size));
+    if (!WriteFile(request->hPipe, header, sizeof(header), &written, NULL) || written != sizeof(header) ||
+        (size && (!WriteFile(request->hPipe, data, size, &written, NULL) || written != size))) {
+        /* Nobody is left to read the listing, so it stops early */
+        request->broken = 1;
+        request->failed = 1;
+    }
+}
+
+/* Send the output gathered so far */
+static void flushOutput(Request *request) {
+    if (request->used)
+        sendFrame(request, LK_FRAME_STDOUT, request->out, (DWORD)request->used);
+    request->used = 0;
+}
+
+/*
+ * writeOutput: Where everything a listing prints ends up; stream is 1 for output, 2 for errors.
+ * Errors go out at once, after the output that precedes them, so the client sees both in order.
+ */
+static void writeOutput(int stream, const char *restrict text, size_t size) {
+    Request *request = t_request;
+    if (!request) {
+        fwrite(text, 1, size, stream == 2 ? stderr : stdout);
+        return;
+    }
+    EnterCriticalSection(&request->lock);
+    if (stream == 2) {
+        flushOutput(request);
+        for (size_t n; size; text += n, size -= n) {
+            n = size < sizeof(request->out) ? size : sizeof(request->out);
+            sendFrame(request, LK_FRAME_STDERR, text, (DWORD)n);
+        }
+    }
+    while (stream != 2 && size) {
+        size_t room = sizeof(request->out) - request->used;
+        size_t n = size < room ? size : room;
+        memcpy(request->out + request->used, text, n);
+        request->used += n;
+        text += n;
+        size -= n;
+        if (request->used == sizeof(request->out))
+            flushOutput(request);
+    }
+    LeaveCriticalSection(&request->lock);
+}
+
+/* printf into writeOutput */
+static void printStream(int stream, const char *restrict format, va_list args) {
+    char text[1024];
+    va_list again;
+    va_copy(again, args);
+    int n = vsnprintf(text, sizeof(text), format, args);
+    if (n >= 0 && (size_t)n < sizeof(text)) {
+        writeOutput(stream, text, (size_t)n);
+    } else if (n > 0) {
+        char *longText = (char *)malloc((size_t)n + 1);
+        if (longText) {
+            vsnprintf(longText, (size_t)n + 1, format, again);
+            writeOutput(stream, longText, (size_t)n);
+            free(longText);
+        }
+    }
+    va_end(again);
+}
+
+/* printOut / printErr: printf to the listing's output or error stream */
+static void printOut(const char *restrict format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (t_request)
+        printStream(1, format, args);
+    else
+        vprintf(format, args);
+    va_end(args);
+}
+
+static void printErr(const char *restrict format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (t_request)
+        printStream(2, format, args);
+    else
+        vfprintf(stderr, format, args);
+    va_end(args);
+}
 
 /* Function prototypes */
 static void fatalError(const char *msg);
-static void initFileList(FileList *list);
-static void addFileEntry(FileList *list, const WIN32_FIND_DATAA *data);
-static void freeFileList(FileList *list);
-static inline void joinPath(const char *restrict base, const char *restrict child, char *restrict result, size_t size);
+static int initFileList(FileList *list);
+static inline int joinPath(const char *restrict base, const char *restrict child, char *restrict result, size_t size);
 static inline int isBinaryFile(const char *restrict filename);
-static inline void formatAttributes(DWORD attr, int isDir, char *restrict outStr, size_t size);
 static void fileTimeToString(const FILETIME *ft, char *restrict buffer, size_t size);
-static void formatSize(ULONGLONG size, char *restrict buffer, size_t bufferSize, int humanReadable);
-static int naturalCompare(const char *restrict a, const char *restrict b);
-static int compareEntries(const void *a, const void *b);
 static void clearLineToEnd(HANDLE hConsole, WORD attr);
-static void printFileEntry(const char *restrict directory, int index, const FileEntry *entry, HANDLE hConsole, WORD defaultAttr);
+static void printFileEntry(const char *restrict directory, int index, const FileEntry *entry, const char *owner, HANDLE hConsole, WORD defaultAttr);
 static void readDirectory(const char *restrict path, FileList *list);
 static inline void printHeader(const char *restrict path);
-static void listDirectory(const char *restrict path, HANDLE hConsole, WORD defaultAttr);
+static void listDirectory(const char *restrict path, HANDLE hConsole, WORD defaultAttr, int depth);
 static void listDirectorySelf(const char *restrict path, HANDLE hConsole, WORD defaultAttr);
 static void treeDirectory(const char *restrict path, HANDLE hConsole, WORD defaultAttr, int indent);
 int getFileOwner(const char *filePath, char *owner, DWORD ownerSize);
 
-/* Print fatal error message and exit; includes Windows error code if relevant */
+/*
+ * Print fatal error message and exit; includes Windows error code if relevant.
+ * Under --serve only the request fails: fatalError marks it and returns, and the
+ * caller unwinds, with every loop of the listing stopping once requestFailed says so.
+ */
 static void fatalError(const char *msg) {
     DWORD err = GetLastError();
-    fprintf(stderr, "Fatal error: %s (Error code: %lu)\n", msg, err);
-    exit(EXIT_FAILURE);
+    printErr("Fatal error: %s (Error code: %lu)\n", msg, err);
+    if (!t_request)
+        exit(EXIT_FAILURE);
+    t_request->failed = 1;
 }
 
-/* Initialize FileList with INITIAL_CAPACITY */
-static void initFileList(FileList *list) {
-    list->count = 0;
-    list->capacity = INITIAL_CAPACITY;
-    list->entries = (FileEntry *)malloc(list->capacity * sizeof(FileEntry));
-    if (UNLIKELY(!list->entries))
-        fatalError("Memory allocation failed for FileList.");
-}
-
-/* Corrected addFileEntry: Added overflow check before doubling capacity */
-static void addFileEntry(FileList *list, const WIN32_FIND_DATAA *data) {
-    if (UNLIKELY(list->count >= list->capacity)) {
-        /* Prevent integer overflow when doubling capacity */
-        if (list->capacity > SIZE_MAX / 2)
-            fatalError("Maximum FileList capacity reached; potential integer overflow.");
-        list->capacity *= 2;
-        FileEntry *temp = (FileEntry *)realloc(list->entries, list->capacity * sizeof(FileEntry));
-        if (UNLIKELY(!temp))
-            fatalError("Memory reallocation failed for FileList.");
-        list->entries = temp;
-    }
-    list->entries[list->count++].findData = *data;
+static inline int requestFailed(void) {
+    return t_request && t_request->failed;
 }
 
-/* Free the FileList memory */
-static void freeFileList(FileList *list) {
-    free(list->entries);
-    list->entries = NULL;
-    list->count = list->capacity = 0;
+/* Initialize FileList; allocation failure is fatal for the CLI. Returns 1 on success */
+static int initFileList(FileList *list) {
+    if (LIKELY(lkInitFileList(list)))
+        return 1;
+    fatalError("Memory allocation failed for FileList.");
+    return 0;
 }
 
-/* Fast ASCII lowercase conversion */
-static inline int fast_tolower(int c) {
-    return (c >= 'A' && c <= 'Z') ? (c | 0x20) : c;
+/* joinPath: lkJoinPath that treats a truncated path as fatal. Returns 1 on success */
+static inline int joinPath(const char *restrict base, const char *restrict child, char *restrict result, size_t size) {
+    if (LIKELY(lkJoinPath(base, child, result, size)))
+        return 1;
+    fatalError("joinPath: Resulting path was truncated.");
+    return 0;
 }
 
 /*
- * joinPath: Safely concatenates the base and child paths into the result buffer.
- * This revised version captures the return value of snprintf to ensure that the resulting
- * string fully fits within the provided buffer. If truncation is detected, a fatal error
- * is raised to prevent subtle path issues that could compromise system integrity.
+ * fullPath: GetFullPathName against the working directory of the client being served,
+ * or of this process outside --serve. Returns 1 on success.
  */
-static inline void joinPath(const char *restrict base, const char *restrict child, char *restrict result, size_t size) {
-    if (UNLIKELY(!base || !child || !result || size == 0))
-        fatalError("Invalid arguments to joinPath.");
-    size_t baseLen = strlen(base);
-    int needsSlash = (baseLen && (base[baseLen - 1] != '\\' && base[baseLen - 1] != '/'));
-    int written;
-    if (needsSlash)
-        written = snprintf(result, size, "%s\\%s", base, child);
-    else
-        written = snprintf(result, size, "%s%s", base, child);
-    if (written < 0 || (size_t)written >= size)
-        fatalError("joinPath: Resulting path was truncated.");
+static int fullPath(const char *restrict path, char *restrict result, DWORD size) {
+    char combined[2 * MAX_PATH];
+    const char *cwd = t_request ? t_request->cwd : NULL;
+    int n = -1;
+    if (!cwd || (path[0] && path[1] == ':' && (path[2] == '\\' || path[2] == '/')) ||
+        ((path[0] == '\\' || path[0] == '/') && (path[1] == '\\' || path[1] == '/'))) {
+        n = snprintf(combined, sizeof(combined), "%s", path);              // Absolute or UNC
+    } else if (path[0] == '\\' || path[0] == '/') {
+        size_t root = 2;                                                   // "X:" or "\\server\share"
+        if (cwd[0] == '\\' && cwd[1] == '\\') {
+            int slashes = 0;
+            for (root = 0; cwd[root] && !(cwd[root] == '\\' && ++slashes == 4); root++)
+                ;
+        }
+        n = snprintf(combined, sizeof(combined), "%.*s%s", (int)root, cwd, path);
+    } else if (path[0] && path[1] == ':') {
+        if (cwd[1] == ':' && toupper((unsigned char)cwd[0]) == toupper((unsigned char)path[0]))
+            n = snprintf(combined, sizeof(combined), "%s\\%s", cwd, path + 2);
+        else
+            n = snprintf(combined, sizeof(combined), "%c:\\%s", path[0], path + 2);
+    } else {
+        n = snprintf(combined, sizeof(combined), "%s\\%s", cwd, path);
+    }
+    if (n < 0 || (size_t)n >= sizeof(combined))
+        return 0;
+    DWORD length = GetFullPathNameA(combined, size, result, NULL);
+    return length && length < size;
 }
 
 /* Check if filename indicates a binary file by extension */
@@ -201,183 +324,12 @@ static inline int isBinaryFile(const char *restrict filename) {
     return 0;
 }
 
-/* Corrected formatAttributes: Now verifies buffer size and aborts if insufficient */
-static inline void formatAttributes(DWORD attr, int isDir, char *restrict outStr, size_t size) {
-    /* Enforce a minimum buffer size of 6 to safely store attributes */
-    if (size < 6)
-        fatalError("Buffer size too small in formatAttributes; expected at least 6 characters.");
-
-    static const char flags[5] = { 'd', 'R', 'H', 'S', 'A' };
-    static const DWORD masks[5] = { 
-        0,  /* Directory is handled separately */
-        FILE_ATTRIBUTE_READONLY,
-        FILE_ATTRIBUTE_HIDDEN,
-        FILE_ATTRIBUTE_SYSTEM,
-        FILE_ATTRIBUTE_ARCHIVE
-    };
-
-    outStr[0] = isDir ? flags[0] : '-';
-    outStr[1] = (attr & masks[1]) ? flags[1] : '-';
-    outStr[2] = (attr & masks[2]) ? flags[2] : '-';
-    outStr[3] = (attr & masks[3]) ? flags[3] : '-';
-    outStr[4] = (attr & masks[4]) ? flags[4] : '-';
-    outStr[5] = '\0';
-}
-
-/*
- * fileTimeToString: Converts a FILETIME structure to a human-readable string in "YYYY-MM-DD HH:MM:SS" format.
- * This updated version first verifies that the provided buffer is large enough (at least 20 characters)
- * to hold the formatted string. It then checks the snprintf return value to ensure no truncation occurs,
- * thereby safeguarding against potential data corruption under edge-case conditions.
- */
+/* fileTimeToString: lkFileTimeToString that treats a conversion failure as fatal */
 static void fileTimeToString(const FILETIME *ft, char *restrict buffer, size_t size) {
-    if (size < 20)
-        fatalError("Buffer size too small in fileTimeToString; expected at least 20 characters.");
-    SYSTEMTIME stUTC, stLocal;
-    if (!FileTimeToSystemTime(ft, &stUTC))
-        fatalError("FileTimeToSystemTime failed.");
-    if (!SystemTimeToTzSpecificLocalTime(NULL, &stUTC, &stLocal))
-        fatalError("SystemTimeToTzSpecificLocalTime failed.");
-    int written = snprintf(buffer, size, "%04d-%02d-%02d %02d:%02d:%02d",
-                 stLocal.wYear, stLocal.wMonth, stLocal.wDay,
-                 stLocal.wHour, stLocal.wMinute, stLocal.wSecond);
-    if (written < 0 || (size_t)written >= size)
-        fatalError("fileTimeToString: Resulting string was truncated.");
-}
-
-/* Format file size; scale to human-readable units if requested */
-static void formatSize(ULONGLONG size, char *restrict buffer, size_t bufferSize, int humanReadable) {
-    if (!humanReadable) {
-        snprintf(buffer, bufferSize, "%llu", size);
-        return;
-    }
-    
-    /* Use a compile-time array of suffix strings */
-    static const char *suffixes[6] = { "B", "K", "M", "G", "T", "P" };
-    
-    /* Use integer scaling for values under threshold to avoid floating point */
-    if (size < 1024) {
-        snprintf(buffer, bufferSize, "%llu%s", size, suffixes[0]);
+    if (lkFileTimeToString(ft, buffer, size))
         return;
-    }
-    
-    /* Find appropriate unit with binary division */
-    int i = 0;
-    double s = (double)size;
-    
-    /* Unroll this loop for common cases */
-    if (s >= 1024) { s /= 1024; i++; }  /* KB */
-    if (s >= 1024) { s /= 1024; i++; }  /* MB */
-    if (s >= 1024) { s /= 1024; i++; }  /* GB */
-    if (s >= 1024 && i < 4) { s /= 1024; i++; }  /* TB */
-    if (s >= 1024 && i < 5) { s /= 1024; i++; }  /* PB */
-    
-    /* Format with one decimal place */
-    snprintf(buffer, bufferSize, "%.1f%s", s, suffixes[i]);
-}
-
-/*
- * Optimized naturalCompare:
- * Uses the inlined fast_tolower function for converting characters to lowercase,
- * which improves performance by avoiding repeated inline conditional logic.
- */
-static int naturalCompare(const char *restrict a, const char *restrict b) {
-    const unsigned char *ua = (const unsigned char *)a;
-    const unsigned char *ub = (const unsigned char *)b;
-    
-    while (*ua && *ub) {
-        if (isdigit(*ua) && isdigit(*ub)) {
-            /* Fast path for single-digit numbers */
-            if (!isdigit(ua[1]) && !isdigit(ub[1])) {
-                if (*ua != *ub)
-                    return *ua - *ub;
-                ua++; ub++;
-                continue;
-            }
-            /* Parse multi-digit numbers efficiently */
-            unsigned long numA = 0, numB = 0;
-            do { numA = numA * 10 + (*ua++ - '0'); } while (isdigit(*ua));
-            do { numB = numB * 10 + (*ub++ - '0'); } while (isdigit(*ub));
-            if (numA != numB)
-                return (numA < numB) ? -1 : 1;
-        } else {
-            /* Utilize fast_tolower to reduce per-character overhead */
-            unsigned char ca = fast_tolower(*ua);
-            unsigned char cb = fast_tolower(*ub);
-            if (ca != cb)
-                return ca - cb;
-            ua++; ub++;
-        }
-    }
-    
-    return (*ua) ? 1 : ((*ub) ? -1 : 0);
-}
-
-/* Compare two FileEntry items with support for various sort options */
-static int compareEntries(const void *a, const void *b) {
-    const FileEntry *fa = (const FileEntry *)a;
-    const FileEntry *fb = (const FileEntry *)b;
-    const DWORD attrA = fa->findData.dwFileAttributes;
-    const DWORD attrB = fb->findData.dwFileAttributes;
-    const int aIsDir = (attrA & FILE_ATTRIBUTE_DIRECTORY) != 0;
-    const int bIsDir = (attrB & FILE_ATTRIBUTE_DIRECTORY) != 0;
-
-    /* Fast path for directory grouping */
-    if (g_options.groupDirs && aIsDir != bIsDir)
-        return aIsDir ? -1 : 1;
-
-    /* Time-based sorting */
-    if (g_options.sortByTime) {
-        /* Direct 64-bit composition instead of bit shifting */
-        ULONGLONG ta = (((ULONGLONG)fa->findData.ftLastWriteTime.dwHighDateTime) << 32) | 
-                         fa->findData.ftLastWriteTime.dwLowDateTime;
-        ULONGLONG tb = (((ULONGLONG)fb->findData.ftLastWriteTime.dwHighDateTime) << 32) | 
-                         fb->findData.ftLastWriteTime.dwLowDateTime;
-        
-        if (ta != tb) {
-            /* Combine conditional with return to eliminate branch */
-            int result = (ta < tb) ? -1 : 1;
-            return g_options.reverseSort ? -result : result;
-        }
-    }
-    
-    /* Size-based sorting */
-    if (g_options.sortBySize) {
-        ULONGLONG sa = (((ULONGLONG)fa->findData.nFileSizeHigh) << 32) | fa->findData.nFileSizeLow;
-        ULONGLONG sb = (((ULONGLONG)fb->findData.nFileSizeHigh) << 32) | fb->findData.nFileSizeLow;
-        
-        if (sa != sb) {
-            int result = (sa < sb) ? -1 : 1;
-            return g_options.reverseSort ? -result : result;
-        }
-    }
-    
-    /* Extension-based sorting - only do string operations if needed */
-    if (g_options.sortByExtension) {
-        const char *extA = strrchr(fa->findData.cFileName, '.');
-        const char *extB = strrchr(fb->findData.cFileName, '.');
-        
-        /* Handle various extension cases efficiently */
-        if (!extA && !extB) {
-            /* No extensions, fall through to name comparison */
-        } else if (extA && !extB) {
-            return g_options.reverseSort ? -1 : 1;
-        } else if (!extA && extB) {
-            return g_options.reverseSort ? 1 : -1;
-        } else {
-            int result = _stricmp(extA, extB);
-            if (result) {
-                return g_options.reverseSort ? -result : result;
-            }
-        }
-    }
-    
-    /* Name-based sorting as fallback */
-    int result = g_options.naturalSort ?
-                 naturalCompare(fa->findData.cFileName, fb->findData.cFileName) :
-                 _stricmp(fa->findData.cFileName, fb->findData.cFileName);
-                 
-    return g_options.reverseSort ? -result : result;
+    fatalError("fileTimeToString: Unable to convert file time.");
+    buffer[0] = '\0';
 }
 
 /*
@@ -388,7 +340,7 @@ static int compareEntries(const void *a, const void *b) {
  */
 static void clearLineToEnd(HANDLE hConsole, WORD attr) {
     CONSOLE_SCREEN_BUFFER_INFO csbi;
-    if (!GetConsoleScreenBufferInfo(hConsole, &csbi))
+    if (!hConsole || !GetConsoleScreenBufferInfo(hConsole, &csbi))
         return;
     int curCol = csbi.dwCursorPosition.X;
     int width = g_consoleWidth;  // Use cached console width
@@ -400,464 +352,2086 @@ static void clearLineToEnd(HANDLE hConsole, WORD attr) {
 }
 
 /*
- * Optimized printFileEntry:
- * This revision introduces a local cache (currentAttr) and the SET_ATTR macro to
- * avoid redundant SetConsoleTextAttribute calls when the attribute value has not changed.
- * This minimizes system call overhead while preserving the intended colored output.
+ * --git state:
+ * Each work tree's index is mapped once per run and kept until listPaths finishes.
+ * The ignore rules of the most recently printed directories are kept in a small LRU
+ * cache, so --merge, whose rows alternate between directories, loads each directory's
+ * .gitignore chain once instead of on every switch.
  */
-static void printFileEntry(const char *restrict directory, int index, const FileEntry *entry, HANDLE hConsole, WORD defaultAttr) {
-    const WIN32_FIND_DATAA *data = &entry->findData;
-    const int isDir = (data->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
-    const WORD baseBG = defaultAttr & 0xF0;
-    const WORD rowBG = (index & 1) ? (baseBG | BACKGROUND_INTENSITY) : baseBG;
-    WORD currentAttr = 0;  // Local cache for current attribute
-
-    // Macro: set new attribute only if it differs from currentAttr
-    #define SET_ATTR(newAttr) do { \
-        if (currentAttr != (newAttr)) { \
-            if (!SetConsoleTextAttribute(hConsole, (newAttr))) { \
-                fprintf(stderr, "Warning: SetConsoleTextAttribute failed.\n"); \
-            } \
-            currentAttr = (newAttr); \
-        } \
-    } while(0)
-
-    SET_ATTR(DEFAULT_COLOR | rowBG);
-    printf("%3d. ", index);
-
-    if (g_options.longFormat) {
-        char attrStr[6];
-        formatAttributes(data->dwFileAttributes, isDir, attrStr, sizeof(attrStr));
-        SET_ATTR(COLOR_ATTR | rowBG);
-        printf("%-6s ", attrStr);
-
-        char sizeStr[32];
-        if (isDir) {
-            strncpy(sizeStr, "<DIR>", sizeof(sizeStr) - 1);
-            sizeStr[sizeof(sizeStr) - 1] = '\0';
-        } else {
-            ULARGE_INTEGER fileSize;
-            fileSize.LowPart = data->nFileSizeLow;
-            fileSize.HighPart = data->nFileSizeHigh;
-            formatSize(fileSize.QuadPart, sizeStr, sizeof(sizeStr), g_options.humanSize);
-        }
-        SET_ATTR(COLOR_SIZE | rowBG);
-        printf("%12s ", sizeStr);
-
-        if (g_options.showCreationTime) {
-            char createTimeStr[32];
-            fileTimeToString(&data->ftCreationTime, createTimeStr, sizeof(createTimeStr));
-            SET_ATTR(COLOR_TIME | rowBG);
-            printf("%20s ", createTimeStr);
-        }
-        char modTimeStr[32];
-        fileTimeToString(&data->ftLastWriteTime, modTimeStr, sizeof(modTimeStr));
-        SET_ATTR(COLOR_TIME | rowBG);
-        printf("%20s ", modTimeStr);
-
-        if (g_options.showOwner) {
-            char fullPath[MAX_PATH];
-            joinPath(directory, data->cFileName, fullPath, MAX_PATH);
-            char owner[256] = "Unknown";
-            if (!getFileOwner(fullPath, owner, sizeof(owner)))
-                strncpy(owner, "Unknown", sizeof(owner) - 1);
-            SET_ATTR(COLOR_OWNER | rowBG);
-            printf("%-20s ", owner);
-        }
-    }
-    if (g_options.fileTypeIndicator) {
-        if (data->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
-            putchar('/');
-        else if (data->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
-            putchar('@');
-        else
-            putchar(' ');
-    }
-    WORD fileColor = (data->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) ? SYMLINK_COLOR :
-                     (data->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? FOLDER_COLOR :
-                     (isBinaryFile(data->cFileName) ? BINARY_COLOR : DEFAULT_COLOR);
-    SET_ATTR((fileColor & 0x0F) | rowBG);
-    printf("%s", data->cFileName);
-    if (g_options.showFullPath) {
-        char fullPath[MAX_PATH];
-        joinPath(directory, data->cFileName, fullPath, MAX_PATH);
-        SET_ATTR(COLOR_FULLPATH | rowBG);
-        printf(" (%s)", fullPath);
+#define GIT_REPO_CAPACITY 16
+#define GIT_DIR_CAPACITY  16
+
+typedef struct {
+    char path[MAX_PATH];
+    int open;                 // dir is valid; 0 when path is outside any readable work tree
+    ULONGLONG lastUsed;
+    LkGitDirectory dir;
+} GitDirSlot;
+
+static THREAD_LOCAL LkGitRepo *g_gitRepos = NULL;      // Allocated on first use
+static THREAD_LOCAL size_t g_gitRepoCount = 0;
+static THREAD_LOCAL char g_gitFailedRoot[MAX_PATH];    // Last root whose index could not be read, reported once
+static THREAD_LOCAL GitDirSlot *g_gitDirs = NULL;      // Allocated on first use
+static THREAD_LOCAL size_t g_gitDirCount = 0;
+static THREAD_LOCAL ULONGLONG g_gitDirClock = 0;
+static THREAD_LOCAL GitDirSlot *g_gitLastDir = NULL;   // Slot of the previous lookup, checked first
+
+/* Forget every cached directory; their repo pointers go stale when g_gitRepos shifts */
+static void gitCloseDirectories(void) {
+    for (size_t i = 0; i < g_gitDirCount; i++) {
+        if (g_gitDirs[i].open)
+            lkGitCloseDirectory(&g_gitDirs[i].dir);
     }
-    clearLineToEnd(hConsole, defaultAttr);
-    putchar('\n');
-    // Reset console attributes to default at the end
-    SET_ATTR(defaultAttr);
-    #undef SET_ATTR
+    g_gitDirCount = 0;
+    g_gitLastDir = NULL;
 }
 
-/* Simple wildcard matching with support for '?' and '*' */
-static int wildcardMatch(const char *restrict pattern, const char *restrict str) {
-    /* Fast path for exact matching or empty pattern */
-    if (!pattern[0]) return !str[0];
-    if (!str[0]) return pattern[0] == '*' && !pattern[1];
-    
-    /* Use more efficient pointer tracking for pattern matching */
-    const char *s = str;
-    const char *p = pattern;
-    const char *star_p = NULL;
-    const char *star_s = NULL;
-    
-    while (*s) {
-        /* Direct char match or single wildcard */
-        if (*p == '?' || ((*p | 0x20) == (*s | 0x20))) {
-            p++;
-            s++;
-        }
-        /* Star wildcard handling with backtracking information */
-        else if (*p == '*') {
-            star_p = p++;
-            star_s = s;
-            /* Skip consecutive stars - they're redundant */
-            while (*p == '*') p++;
-            if (!*p) return 1; /* Trailing star matches everything */
-        }
-        /* Backtrack to last star if available */
-        else if (star_p) {
-            p = star_p + 1;
-            s = ++star_s;
-        }
-        else {
-            return 0;
+/* Find or open the repository rooted at root; the oldest one is closed when all slots are taken */
+static LkGitRepo *gitOpenRepo(const char *restrict root) {
+    for (size_t i = 0; i < g_gitRepoCount; i++) {
+        if (!_stricmp(g_gitRepos[i].root, root))
+            return &g_gitRepos[i];
+    }
+    if (!_stricmp(g_gitFailedRoot, root))
+        return NULL;
+    if (!g_gitRepos) {
+        g_gitRepos = (LkGitRepo *)calloc(GIT_REPO_CAPACITY, sizeof(LkGitRepo));
+        if (!g_gitRepos) {
+            fatalError("Memory allocation failed for git repositories.");
+            return NULL;
         }
     }
-    
-    /* Skip any trailing stars */
-    while (*p == '*') p++;
-    
-    return !*p;
+    if (g_gitRepoCount == GIT_REPO_CAPACITY) {
+        gitCloseDirectories();
+        lkGitCloseRepo(&g_gitRepos[0]);
+        memmove(&g_gitRepos[0], &g_gitRepos[1], (GIT_REPO_CAPACITY - 1) * sizeof(LkGitRepo));
+        g_gitRepoCount--;
+    }
+    LkGitRepo *repo = &g_gitRepos[g_gitRepoCount];
+    if (!lkGitOpenRepo(repo, root)) {
+        printErr("Error: Unable to read the git index of '%s' (Error code: %lu)\n", root, GetLastError());
+        strncpy(g_gitFailedRoot, root, MAX_PATH - 1);
+        return NULL;
+    }
+    g_gitRepoCount++;
+    return repo;
 }
 
-/* Corrected readDirectory: Uses safe string copies and bounds checks for wildcard and directory names */
-static void readDirectory(const char *restrict path, FileList *list) {
-    char directory[MAX_PATH] = {0};
-    char wildcard[256] = {0};
-    int hasWildcard = (strchr(path, '*') || strchr(path, '?'));
-
-    if (hasWildcard) {
-        const char *sep = strrchr(path, '\\');
-        if (!sep) sep = strrchr(path, '/');
-        if (sep) {
-            size_t dirLen = sep - path;
-            if (dirLen >= MAX_PATH) {
-                dirLen = MAX_PATH - 1; /* Truncate to avoid overflow */
-                fprintf(stderr, "Warning: Directory path truncated to %d characters: '%s'\n", MAX_PATH - 1, path);
-            }
-            memcpy(directory, path, dirLen);
-            directory[dirLen] = '\0';
-            /* Safely copy the wildcard pattern */
-            strncpy(wildcard, sep + 1, sizeof(wildcard) - 1);
-            wildcard[sizeof(wildcard) - 1] = '\0';
-        } else {
-            strncpy(directory, ".", MAX_PATH - 1);
-            directory[MAX_PATH - 1] = '\0';
-            strncpy(wildcard, path, sizeof(wildcard) - 1);
-            wildcard[sizeof(wildcard) - 1] = '\0';
+/* Git status of an entry listed from directory (which may end in a wildcard component) */
+static LkGitStatus gitEntryStatus(const char *restrict directory, const FileEntry *entry) {
+    char path[MAX_PATH];
+    strncpy(path, directory, MAX_PATH - 1);
+    path[MAX_PATH - 1] = '\0';
+    if (strchr(path, '*') || strchr(path, '?')) {
+        char *sep = strrchr(path, '\\');
+        if (!sep)
+            sep = strrchr(path, '/');
+        if (sep)
+            *sep = '\0';
+    }
+    GitDirSlot *slot = g_gitLastDir;
+    if (!slot || _stricmp(slot->path, path)) {
+        slot = NULL;
+        for (size_t i = 0; i < g_gitDirCount && !slot; i++) {
+            if (!_stricmp(g_gitDirs[i].path, path))
+                slot = &g_gitDirs[i];
         }
-    } else {
-        size_t pathLen = strlen(path);
-        if (pathLen >= MAX_PATH) {
-            pathLen = MAX_PATH - 1; /* Truncate to avoid overflow */
-            fprintf(stderr, "Warning: Path truncated to %d characters: '%s'\n", MAX_PATH - 1, path);
+    }
+    if (!slot) {
+        char root[MAX_PATH];
+        LkGitRepo *repo = NULL;
+        if (lkGitFindRoot(path, root, sizeof(root)))
+            repo = gitOpenRepo(root);   /* May evict a repository and with it the cached directories */
+        if (!g_gitDirs) {
+            g_gitDirs = (GitDirSlot *)calloc(GIT_DIR_CAPACITY, sizeof(GitDirSlot));
+            if (!g_gitDirs) {
+                fatalError("Memory allocation failed for git directories.");
+                return LK_GIT_NONE;
+            }
         }
-        strncpy(directory, path, pathLen);
-        directory[pathLen] = '\0';
-        /* Safely apply the global filter pattern if specified */
-        if (g_options.filterPattern[0]) {
-            strncpy(wildcard, g_options.filterPattern, sizeof(wildcard) - 1);
-            wildcard[sizeof(wildcard) - 1] = '\0';
+        if (g_gitDirCount == GIT_DIR_CAPACITY) {
+            slot = &g_gitDirs[0];
+            for (size_t i = 1; i < g_gitDirCount; i++) {
+                if (g_gitDirs[i].lastUsed < slot->lastUsed)
+                    slot = &g_gitDirs[i];
+            }
+            if (slot->open)
+                lkGitCloseDirectory(&slot->dir);
+        } else {
+            slot = &g_gitDirs[g_gitDirCount++];
         }
+        strcpy(slot->path, path);
+        slot->open = repo && lkGitOpenDirectory(&slot->dir, repo, path);
     }
+    slot->lastUsed = ++g_gitDirClock;
+    g_gitLastDir = slot;
+    return slot->open ? lkGitEntryStatus(&slot->dir, entry, g_options.gitDirs ? LK_GIT_DEEP : 0) : LK_GIT_NONE;
+}
 
-    char searchPath[MAX_PATH];
-    size_t dirLen = strlen(directory);
-    if (dirLen > 0 && directory[dirLen - 1] != '\\')
-        snprintf(searchPath, sizeof(searchPath), "%s\\*", directory);
-    else
-        snprintf(searchPath, sizeof(searchPath), "%s*", directory);
-
-    WIN32_FIND_DATAA findData;
-    HANDLE hFind = FindFirstFileExA(
-        searchPath,
-        FindExInfoBasic,         /* Use basic info for performance */
-        &findData,
-        FindExSearchNameMatch,
-        NULL,
-        FIND_FIRST_EX_LARGE_FETCH /* Optimize for large directories */
-    );
-    if (hFind == INVALID_HANDLE_VALUE) {
-        fprintf(stderr, "Error: Unable to open directory '%s' (Error code: %lu)\n", directory, GetLastError());
+/* Unmap every repository; the next listing sees the index as it is then */
+static void gitReset(void) {
+    gitCloseDirectories();
+    free(g_gitDirs);
+    g_gitDirs = NULL;
+    g_gitFailedRoot[0] = '\0';
+    for (size_t i = 0; i < g_gitRepoCount; i++)
+        lkGitCloseRepo(&g_gitRepos[i]);
+    g_gitRepoCount = 0;
+    free(g_gitRepos);
+    g_gitRepos = NULL;
+}
+
+/*
+ * Row plans:
+ * The columns of a listing are decided once per listing by buildRowPlan, which turns
+ * the options into a fixed sequence of column kernels. printColumnHeader and
+ * printFileEntry both walk that plan, so neither checks an option per row. Each kernel
+ * appends its field to a line buffer with integer-only formatting and starts a new
+ * color run when its color differs. A row is then written in one piece when output
+ * is redirected, or one write per color run on a console.
+ */
+#define ROW_MAX_COLUMNS  12
+#define ROW_BUFFER_SIZE  2048
+
+typedef struct {
+    const char *directory;
+    const FileEntry *entry;
+    const char *owner;       // Fetched ahead of time, or NULL to look it up when -O needs it
+    int index;
+    WORD rowBG;
+} RowSource;
+
+typedef struct {
+    char text[ROW_BUFFER_SIZE];
+    size_t length;
+    size_t runStart[ROW_MAX_COLUMNS + 1];   // Offset at which each color run begins
+    WORD runAttr[ROW_MAX_COLUMNS + 1];
+    int runs;
+} RowBuffer;
+
+typedef void (*ColumnKernel)(RowBuffer *row, const RowSource *source);
+
+typedef struct {
+    ColumnKernel kernel;
+    const char *title;   // Long-format header title, NULL if the column has none
+    int width;           // Header field width; negative for left-aligned
+} Column;
+
+typedef struct {
+    Column columns[ROW_MAX_COLUMNS];
+    int count;
+    int ruleWidth;       // Dashes under the header; 0 without a header
+} RowPlan;
+
+static THREAD_LOCAL RowPlan g_rowPlan;
+
+/* Switch the color of the text that follows */
+static inline void rowColor(RowBuffer *row, WORD attr) {
+    if (row->runs && row->runAttr[row->runs - 1] == attr)
         return;
+    row->runStart[row->runs] = row->length;
+    row->runAttr[row->runs++] = attr;
+}
+
+/* Append n bytes, clipped to the buffer (one byte is kept for the newline) */
+static inline void rowAppend(RowBuffer *row, const char *restrict text, size_t n) {
+    const size_t room = sizeof(row->text) - 1 - row->length;
+    if (UNLIKELY(n > room))
+        n = room;
+    memcpy(row->text + row->length, text, n);
+    row->length += n;
+}
+
+static inline void rowFill(RowBuffer *row, char c, size_t n) {
+    const size_t room = sizeof(row->text) - 1 - row->length;
+    if (UNLIKELY(n > room))
+        n = room;
+    memset(row->text + row->length, c, n);
+    row->length += n;
+}
+
+/* Append text padded to width, as "%*s" (or "%-*s" for a negative width) would */
+static inline void rowPadded(RowBuffer *row, const char *restrict text, size_t n, int width) {
+    const size_t pad = (size_t)(width < 0 ? -width : width);
+    if (width > 0 && n < pad)
+        rowFill(row, ' ', pad - n);
+    rowAppend(row, text, n);
+    if (width < 0 && n < pad)
+        rowFill(row, ' ', pad - n);
+}
+
+static void columnIndex(RowBuffer *row, const RowSource *source) {
+    char digits[24];
+    size_t n = lkFormatUnsigned((unsigned)source->index, digits, sizeof(digits));
+    rowColor(row, DEFAULT_COLOR | source->rowBG);
+    rowPadded(row, digits, n, 3);
+    rowAppend(row, ". ", 2);
+}
+
+static void columnGit(RowBuffer *row, const RowSource *source) {
+    static const char statusChars[] = { ' ', ' ', 'M', '?', '!' };
+    static const WORD statusColors[] = { DEFAULT_COLOR, DEFAULT_COLOR, COLOR_GIT_MODIFIED,
+                                         COLOR_GIT_UNTRACKED, COLOR_GIT_IGNORED };
+    LkGitStatus status = gitEntryStatus(source->directory, source->entry);
+    rowColor(row, statusColors[status] | source->rowBG);
+    const char text[2] = { statusChars[status], ' ' };
+    rowAppend(row, text, 2);
+}
+
+static void columnAttr(RowBuffer *row, const RowSource *source) {
+    const DWORD attr = source->entry->findData.dwFileAttributes;
+    char text[8];
+    lkFormatAttributes(attr, (attr & FILE_ATTRIBUTE_DIRECTORY) != 0, text, sizeof(text));
+    text[5] = ' ';
+    text[6] = ' ';
+    rowColor(row, COLOR_ATTR | source->rowBG);
+    rowAppend(row, text, 7);
+}
+
+static inline void appendSize(RowBuffer *row, const RowSource *source, int humanReadable) {
+    const WIN32_FIND_DATAA *data = &source->entry->findData;
+    rowColor(row, COLOR_SIZE | source->rowBG);
+    if (data->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+        rowPadded(row, "<DIR>", 5, 12);
+    } else {
+        char text[32];
+        const ULONGLONG size = ((ULONGLONG)data->nFileSizeHigh << 32) | data->nFileSizeLow;
+        rowPadded(row, text, lkFormatSize(size, text, sizeof(text), humanReadable), 12);
     }
+    rowAppend(row, " ", 1);
+}
 
-    const size_t wildcardLen = strlen(wildcard);
-    do {
-        /* Skip current and parent directory entries */
-        if (findData.cFileName[0] == '.' &&
-            (findData.cFileName[1] == '\0' ||
-             (findData.cFileName[1] == '.' && findData.cFileName[2] == '\0')))
-            continue;
+static void columnSize(RowBuffer *row, const RowSource *source) {
+    appendSize(row, source, 0);
+}
 
-        /* Filter out hidden files unless showAll is enabled */
-        if (!g_options.showAll && (findData.dwFileAttributes & FILE_ATTRIBUTE_HIDDEN))
-            continue;
+static void columnHumanSize(RowBuffer *row, const RowSource *source) {
+    appendSize(row, source, 1);
+}
 
-        /* Apply wildcard filter if present */
-        if (wildcardLen && !wildcardMatch(wildcard, findData.cFileName))
-            continue;
+static inline void appendTime(RowBuffer *row, const RowSource *source, const FILETIME *ft) {
+    char text[32];
+    fileTimeToString(ft, text, sizeof(text));
+    rowColor(row, COLOR_TIME | source->rowBG);
+    rowPadded(row, text, strlen(text), 20);
+    rowAppend(row, " ", 1);
+}
 
-        addFileEntry(list, &findData);
-    } while (FindNextFileA(hFind, &findData));
+static void columnCreated(RowBuffer *row, const RowSource *source) {
+    appendTime(row, source, &source->entry->findData.ftCreationTime);
+}
 
-    FindClose(hFind);
+static void columnModified(RowBuffer *row, const RowSource *source) {
+    appendTime(row, source, &source->entry->findData.ftLastWriteTime);
 }
 
-/* Print header with full (absolute) path */
-static inline void printHeader(const char *restrict path) {
-    char absPath[MAX_PATH] = {0};
-    if (!GetFullPathNameA(path, MAX_PATH, absPath, NULL))
-        strncpy(absPath, path, MAX_PATH - 1);
-    printf("\n[%s]:\n", absPath);
-    if (g_options.longFormat) {
-        if (g_options.showOwner) {
-            if (g_options.showCreationTime)
-                printf("    %-6s %12s %20s %20s %-20s %s\n", "Attr", "Size", "Created", "Modified", "Owner", "Name");
-            else
-                printf("    %-6s %12s %20s %-20s %s\n", "Attr", "Size", "Modified", "Owner", "Name");
-            printf("    -----------------------------------------------------------------------------------------------\n");
-        } else {
-            if (g_options.showCreationTime)
-                printf("    %-6s %12s %20s %20s %s\n", "Attr", "Size", "Created", "Modified", "Name");
-            else
-                printf("    %-6s %12s %20s %s\n", "Attr", "Size", "Modified", "Name");
-            printf("    --------------------------------------------------------------------------------\n");
-        }
+static void columnOwner(RowBuffer *row, const RowSource *source) {
+    char ownerBuf[256] = "Unknown";
+    const char *owner = source->owner;
+    /* Archive members have no security descriptor of their own */
+    if (!owner && !(source->entry->flags & LK_ENTRY_ARCHIVE_MEMBER)) {
+        char fullPath[MAX_PATH];
+        if (joinPath(source->directory, source->entry->findData.cFileName, fullPath, MAX_PATH) &&
+            !getFileOwner(fullPath, ownerBuf, sizeof(ownerBuf)))
+            strncpy(ownerBuf, "Unknown", sizeof(ownerBuf) - 1);
+        owner = ownerBuf;
+    }
+    rowColor(row, COLOR_OWNER | source->rowBG);
+    rowPadded(row, owner, strlen(owner), -20);
+    rowAppend(row, " ", 1);
+}
+
+/* -F: printed in the color of the preceding field */
+static void columnType(RowBuffer *row, const RowSource *source) {
+    const DWORD attr = source->entry->findData.dwFileAttributes;
+    const char c = (attr & FILE_ATTRIBUTE_DIRECTORY) ? '/' :
+                   (attr & FILE_ATTRIBUTE_REPARSE_POINT) ? '@' : ' ';
+    rowAppend(row, &c, 1);
+}
+
+static void columnName(RowBuffer *row, const RowSource *source) {
+    const WIN32_FIND_DATAA *data = &source->entry->findData;
+    WORD fileColor = (data->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) ? SYMLINK_COLOR :
+                     (data->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? FOLDER_COLOR :
+                     (isBinaryFile(data->cFileName) ? BINARY_COLOR : DEFAULT_COLOR);
+    rowColor(row, (fileColor & 0x0F) | source->rowBG);
+    rowAppend(row, data->cFileName, strlen(data->cFileName));
+}
+
+static void columnFullPath(RowBuffer *row, const RowSource *source) {
+    char fullPath[MAX_PATH];
+    if (!joinPath(source->directory, source->entry->findData.cFileName, fullPath, MAX_PATH))
+        fullPath[0] = '\0';
+    rowColor(row, COLOR_FULLPATH | source->rowBG);
+    rowAppend(row, " (", 2);
+    rowAppend(row, fullPath, strlen(fullPath));
+    rowAppend(row, ")", 1);
+}
+
+static inline void addColumn(RowPlan *plan, ColumnKernel kernel, const char *title, int width) {
+    plan->columns[plan->count].kernel = kernel;
+    plan->columns[plan->count].title = title;
+    plan->columns[plan->count].width = width;
+    plan->count++;
+}
+
+/* buildRowPlan: Lay out the columns for g_options; --merge asks for full paths regardless of -P */
+static void buildRowPlan(int showFullPath) {
+    RowPlan *plan = &g_rowPlan;
+    plan->count = 0;
+    addColumn(plan, columnIndex, NULL, 0);
+    if (g_options.gitStatus)
+        addColumn(plan, columnGit, "G", -1);
+    if (g_options.lk.longFormat) {
+        addColumn(plan, columnAttr, "Attr", -6);
+        addColumn(plan, g_options.lk.humanSize ? columnHumanSize : columnSize, "Size", 12);
+        if (g_options.lk.showCreationTime)
+            addColumn(plan, columnCreated, "Created", 20);
+        addColumn(plan, columnModified, "Modified", 20);
+        if (g_options.lk.showOwner)
+            addColumn(plan, columnOwner, "Owner", -20);
     }
+    if (g_options.lk.fileTypeIndicator)
+        addColumn(plan, columnType, NULL, 0);
+    addColumn(plan, columnName, NULL, 0);
+    if (showFullPath)
+        addColumn(plan, columnFullPath, NULL, 0);
+    plan->ruleWidth = !g_options.lk.longFormat ? 0 : g_options.lk.showOwner ? 95 : 80;
+}
+
+/* Set a console attribute, warning if the console refuses it */
+static inline void setConsoleAttr(HANDLE hConsole, WORD attr) {
+    if (!SetConsoleTextAttribute(hConsole, attr))
+        printErr("Warning: SetConsoleTextAttribute failed.\n");
 }
 
 /*
- * Optimized listDirectory:
- * Merges the printing, summary computation, and recursion-directory collection loops
- * into a single iteration over file entries, reducing redundant passes over the data.
- * For recursive directory processing, directory indices are temporarily stored to
- * minimize repeated scans of the file list.
+ * printFileEntry: Run the row plan over one entry.
+ * Without a console the colors are dropped and the line goes out in a single write;
+ * on a console each color run is written after its attribute is set, and the rest of
+ * the line is cleared so the alternating row background spans the full width.
  */
-static void listDirectory(const char *restrict path, HANDLE hConsole, WORD defaultAttr) {
-    FileList list;
-    initFileList(&list);
-    readDirectory(path, &list);
-    if (list.count > 0)
-        qsort(list.entries, list.count, sizeof(FileEntry), compareEntries);
+static void printFileEntry(const char *restrict directory, int index, const FileEntry *entry, const char *owner, HANDLE hConsole, WORD defaultAttr) {
+    const WORD baseBG = defaultAttr & 0xF0;
+    const RowSource source = { directory, entry, owner, index,
+                               (WORD)((index & 1) ? (baseBG | BACKGROUND_INTENSITY) : baseBG) };
+    RowBuffer row;
+    row.length = 0;
+    row.runs = 0;
+    for (int i = 0; i < g_rowPlan.count; i++)
+        g_rowPlan.columns[i].kernel(&row, &source);
+
+    if (!hConsole) {
+        row.text[row.length++] = '\n';
+        writeOutput(1, row.text, row.length);
+        return;
+    }
+    for (int i = 0; i < row.runs; i++) {
+        const size_t end = i + 1 < row.runs ? row.runStart[i + 1] : row.length;
+        setConsoleAttr(hConsole, row.runAttr[i]);
+        writeOutput(1, row.text + row.runStart[i], end - row.runStart[i]);
+    }
+    clearLineToEnd(hConsole, defaultAttr);
+    writeOutput(1, "\n", 1);
+    // Reset console attributes to default at the end
+    if (!row.runs || row.runAttr[row.runs - 1] != defaultAttr)
+        setConsoleAttr(hConsole, defaultAttr);
+}
 
-    printHeader(path);
+/*
+ * Directory cache used by --serve:
+ * Keeps the filtered, unsorted entries of recently listed directories together with a
+ * change notification handle. A cached list is reused until its directory signals a
+ * change, so relisting an unchanged directory costs one WaitForSingleObject instead
+ * of a FindFirstFile walk. The least recently used slot is recycled when full.
+ */
+#define DIR_CACHE_CAPACITY 256
 
-    // Allocate a temporary array to collect indices of directories for recursion.
-    size_t *recDirs = NULL;
-    size_t recCount = 0;
-    if (g_options.recursive && !g_options.treeView) {
-        recDirs = (size_t*)malloc(list.count * sizeof(size_t));
-        if (!recDirs)
-            fatalError("Memory allocation failed for recursive directories array.");
+typedef struct {
+    char path[MAX_PATH];
+    char filterPattern[256];
+    int showAll;
+    int inodeOrder;       // Entries carry file IDs
+    HANDLE hChange;       // Signaled when an entry of the directory changes
+    ULONGLONG lastUsed;   // LRU stamp from g_dirCacheClock
+    FileList list;
+} DirCacheEntry;
+
+static DirCacheEntry *g_dirCache = NULL;   // NULL unless running as a server
+static size_t g_dirCacheCount = 0;
+static ULONGLONG g_dirCacheClock = 0;
+static SRWLOCK g_dirCacheLock = SRWLOCK_INIT;   // Shared by all requests; directories are read outside it
+
+/* Close and free a cache slot, moving the last slot into its place */
+static void evictDirCacheEntry(DirCacheEntry *slot) {
+    FindCloseChangeNotification(slot->hChange);
+    lkFreeFileList(&slot->list);
+    *slot = g_dirCache[--g_dirCacheCount];
+}
+
+/* The slot caching path as the current options would read it, or NULL */
+static DirCacheEntry *findDirCacheEntry(const char *restrict path) {
+    for (size_t i = 0; i < g_dirCacheCount; i++) {
+        DirCacheEntry *candidate = &g_dirCache[i];
+        if (candidate->showAll == g_options.lk.showAll && candidate->inodeOrder == g_options.lk.inodeOrder &&
+            !_stricmp(candidate->path, path) &&
+            !strcmp(candidate->filterPattern, g_options.lk.filterPattern))
+            return candidate;
     }
+    return NULL;
+}
 
-    int dirCount = 0, fileCount = 0;
-    ULONGLONG totalSize = 0;
-    for (size_t i = 0; i < list.count; ++i) {
-        printFileEntry(path, (int)(i + 1), &list.entries[i], hConsole, defaultAttr);
-        const WIN32_FIND_DATAA *data = &list.entries[i].findData;
-        if (data->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-            ++dirCount;
-            if (g_options.recursive && !g_options.treeView &&
-                !(data->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
-                recDirs[recCount++] = i;
-            }
-        } else {
-            ++fileCount;
-            ULARGE_INTEGER fileSize;
-            fileSize.LowPart = data->nFileSizeLow;
-            fileSize.HighPart = data->nFileSizeHigh;
-            totalSize += fileSize.QuadPart;
+/* Append a copy of every entry of source to list; returns 1 on success */
+static int copyFileList(FileList *list, const FileList *source) {
+    for (size_t i = 0; i < source->count; i++) {
+        if (UNLIKELY(!lkAddFileEntry(list, &source->entries[i]))) {
+            fatalError("Memory reallocation failed for FileList.");
+            return 0;
         }
     }
+    return 1;
+}
 
-    if (g_options.showSummary) {
-        char sizeStr[32] = {0};
-        formatSize(totalSize, sizeStr, sizeof(sizeStr), g_options.humanSize);
-        printf("\nSummary: %d directories, %d files, total size: %s\n", 
-               dirCount, fileCount, sizeStr);
+/*
+ * Serve readDirectory from the cache, filling it on a miss.
+ * Returns 0 when the directory cannot be cached so the caller falls back to a plain read.
+ * A directory that changed since it was cached is read afresh like a miss. Other requests
+ * only wait for the lookup and the copy, never for a directory being read.
+ */
+static int readDirectoryCached(const char *restrict path, FileList *list) {
+    AcquireSRWLockExclusive(&g_dirCacheLock);
+    DirCacheEntry *slot = findDirCacheEntry(path);
+    if (slot && WaitForSingleObject(slot->hChange, 0) == WAIT_OBJECT_0) {
+        evictDirCacheEntry(slot);
+        slot = NULL;
     }
+    if (slot) {
+        slot->lastUsed = ++g_dirCacheClock;
+        copyFileList(list, &slot->list);
+        ReleaseSRWLockExclusive(&g_dirCacheLock);
+        return 1;
+    }
+    ReleaseSRWLockExclusive(&g_dirCacheLock);
+    if (strlen(path) >= MAX_PATH)
+        return 0;
 
-    if (g_options.recursive && !g_options.treeView) {
-        for (size_t i = 0; i < recCount; i++) {
-            const WIN32_FIND_DATAA *data = &list.entries[recDirs[i]].findData;
-            char newPath[MAX_PATH] = {0};
-            joinPath(path, data->cFileName, newPath, MAX_PATH);
-            listDirectory(newPath, hConsole, defaultAttr);
+    /* Watch before reading so that no change between the two goes unnoticed */
+    DirCacheEntry fresh;
+    fresh.hChange = FindFirstChangeNotificationA(path, FALSE,
+        FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
+        FILE_NOTIFY_CHANGE_ATTRIBUTES | FILE_NOTIFY_CHANGE_SIZE |
+        FILE_NOTIFY_CHANGE_LAST_WRITE);
+    if (fresh.hChange == INVALID_HANDLE_VALUE)
+        return 0;
+    if (!lkInitFileList(&fresh.list) || !lkReadDirectory(&g_options.lk, path, &fresh.list) ||
+        !copyFileList(list, &fresh.list)) {
+        FindCloseChangeNotification(fresh.hChange);
+        lkFreeFileList(&fresh.list);
+        return requestFailed();
+    }
+    strcpy(fresh.path, path);
+    strcpy(fresh.filterPattern, g_options.lk.filterPattern);
+    fresh.showAll = g_options.lk.showAll;
+    fresh.inodeOrder = g_options.lk.inodeOrder;
+
+    AcquireSRWLockExclusive(&g_dirCacheLock);
+    /* Another request may have cached the directory meanwhile; the newer read replaces it */
+    if ((slot = findDirCacheEntry(path)) != NULL) {
+        evictDirCacheEntry(slot);
+    } else if (g_dirCacheCount == DIR_CACHE_CAPACITY) {
+        DirCacheEntry *oldest = &g_dirCache[0];
+        for (size_t i = 1; i < g_dirCacheCount; i++) {
+            if (g_dirCache[i].lastUsed < oldest->lastUsed)
+                oldest = &g_dirCache[i];
         }
-        free(recDirs);
+        evictDirCacheEntry(oldest);
     }
-    freeFileList(&list);
+    fresh.lastUsed = ++g_dirCacheClock;
+    g_dirCache[g_dirCacheCount++] = fresh;
+    ReleaseSRWLockExclusive(&g_dirCacheLock);
+    return 1;
 }
 
-/* List a single directory entry (not its contents) */
-static void listDirectorySelf(const char *restrict path, HANDLE hConsole, WORD defaultAttr) {
-    WIN32_FIND_DATAA data;
-    HANDLE hFind = FindFirstFileA(path, &data);
-    if (hFind == INVALID_HANDLE_VALUE) {
-        fprintf(stderr, "Error: Unable to retrieve info for '%s' (Error code: %lu)\n", path, GetLastError());
+/* Read the filtered entries of path into list, reporting unreadable directories */
+static void readDirectory(const char *restrict path, FileList *list) {
+    /* Wildcard paths are listed fresh; the cache only tracks whole directories */
+    if (g_dirCache && !g_options.lk.predicateCount && !strchr(path, '*') && !strchr(path, '?') && readDirectoryCached(path, list))
         return;
-    }
-    FindClose(hFind);
-    printHeader(path);
-    FileEntry entry;
-    entry.findData = data;
-    printFileEntry(path, 1, &entry, hConsole, defaultAttr);
+    if (lkReadDirectory(&g_options.lk, path, list))
+        return;
+    DWORD err = GetLastError();
+    if (err == ERROR_NOT_ENOUGH_MEMORY)
+        fatalError("Memory reallocation failed for FileList.");
+    else
+        printErr("Error: Unable to open directory '%s' (Error code: %lu)\n", path, err);
 }
 
-/* Corrected treeDirectory: Adds recursion depth limit and skips reparse points to ensure system resilience */
+static inline void printColumnHeader(void);
+
+/* Print header with full (absolute) path */
+static inline void printHeader(const char *restrict path) {
+    char absPath[MAX_PATH] = {0};
+    if (!GetFullPathNameA(path, MAX_PATH, absPath, NULL))
+        strncpy(absPath, path, MAX_PATH - 1);
+    printOut("\n[%s]:\n", absPath);
+    printColumnHeader();
+}
+
+/* Column titles of the long format, taken from the row plan */
+static inline void printColumnHeader(void) {
+    if (!g_rowPlan.ruleWidth)
+        return;
+    RowBuffer row;
+    row.length = 0;
+    rowAppend(&row, "    ", 4);
+    for (int i = 0; i < g_rowPlan.count; i++) {
+        const Column *column = &g_rowPlan.columns[i];
+        if (column->title) {
+            rowPadded(&row, column->title, strlen(column->title), column->width);
+            rowAppend(&row, " ", 1);
+        }
+    }
+    rowAppend(&row, "Name\n    ", 9);
+    rowFill(&row, '-', (size_t)g_rowPlan.ruleWidth);
+    row.text[row.length++] = '\n';
+    writeOutput(1, row.text, row.length);
+}
+
+/*
+ * --inode-order:
+ * Owner lookups and subdirectory reads are issued in file ID order, which follows the
+ * order of the file records on disk, so a cold-cache walk seeks forward instead of
+ * jumping around. Rows are still printed in the order chosen by the sort options.
+ * The ordering is done in batches of INODE_BATCH rows or subdirectories: a larger batch
+ * seeks less but holds more owner names or child listings in memory and makes the
+ * first row wait longer, so the batch bounds both regardless of directory size.
+ * Subdirectory listings read ahead are also counted across the whole walk: while one of
+ * them is being listed, its own subdirectories may only use what is left of INODE_BATCH,
+ * so deep trees do not hold a batch per level.
+ */
+#define INODE_BATCH 1024
+
+typedef struct {
+    ULONGLONG fileId;
+    size_t position;   // Offset within the batch orderById was given
+} IdOrder;
+
+static int compareIdOrder(const void *a, const void *b) {
+    const IdOrder *ia = (const IdOrder *)a, *ib = (const IdOrder *)b;
+    if (ia->fileId != ib->fileId)
+        return ia->fileId < ib->fileId ? -1 : 1;
+    return ia->position < ib->position ? -1 : (ia->position > ib->position);
+}
+
+/*
+ * Fill order with the positions 0..count-1 of the entries list->entries[indices[i]]
+ * (or list->entries[first + i] without indices), sorted by file ID; count <= INODE_BATCH
+ */
+static void orderById(const FileList *list, const size_t *indices, size_t first, size_t count, IdOrder *order) {
+    for (size_t i = 0; i < count; i++) {
+        order[i].fileId = list->entries[indices ? indices[i] : first + i].fileId;
+        order[i].position = i;
+    }
+    qsort(order, count, sizeof(IdOrder), compareIdOrder);
+}
+
+/*
+ * Look up the owners of rows first..first+count-1 in file ID order; owners[i] is NULL for
+ * hidden rows, and for every row not reached when the request fails
+ */
+static void prefetchOwners(const char *restrict path, const FileList *list, size_t first, size_t count, char **owners) {
+    IdOrder order[INODE_BATCH];
+    orderById(list, NULL, first, count, order);
+    memset(owners, 0, count * sizeof(*owners));
+    for (size_t k = 0; k < count && !requestFailed(); k++) {
+        const FileEntry *entry = &list->entries[first + order[k].position];
+        if (entry->flags & (LK_ENTRY_TRAVERSE_ONLY | LK_ENTRY_ARCHIVE_MEMBER))
+            continue;
+        char fullPath[MAX_PATH];
+        char owner[256] = "Unknown";
+        if (!joinPath(path, entry->findData.cFileName, fullPath, MAX_PATH))
+            return;
+        if (!getFileOwner(fullPath, owner, sizeof(owner)))
+            strncpy(owner, "Unknown", sizeof(owner) - 1);
+        owners[order[k].position] = _strdup(owner);
+        if (!owners[order[k].position])
+            fatalError("Memory allocation failed for owner names.");
+    }
+}
+
+static void freeOwners(char **owners, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        free(owners[i]);
+}
+
+static THREAD_LOCAL size_t g_readAhead = 0;   // Subdirectory listings read ahead and not yet listed, at most INODE_BATCH
+
+/*
+ * -L: directories are identified by volume serial number and file ID, so a link,
+ * junction or mount point leading back into the walk is recognized with one hash
+ * lookup. Each directory is listed once; a directory that is still open further up
+ * the walk is a cycle, any other repeat was listed elsewhere.
+ */
+typedef struct {
+    DWORD volume;
+    ULONGLONG fileId;
+} VisitKey;
+
+typedef struct {
+    VisitKey key;
+    int used;
+    int active;        // Being listed: the directory is an ancestor of the current one
+} VisitSlot;
+
+typedef enum { VISIT_NEW, VISIT_SEEN, VISIT_CYCLE, VISIT_UNKNOWN } VisitState;
+
+static THREAD_LOCAL VisitSlot *g_visited = NULL;
+static THREAD_LOCAL size_t g_visitedCount = 0;
+static THREAD_LOCAL size_t g_visitedCapacity = 0;   // Power of two, at most half full
+
+static VisitSlot *findVisitSlot(VisitSlot *slots, size_t capacity, const VisitKey *key) {
+    ULONGLONG hash = (key->fileId ^ ((ULONGLONG)key->volume << 32)) * 0x9E3779B97F4A7C15ULL;
+    size_t i = (size_t)(hash >> 32) & (capacity - 1);
+    while (slots[i].used && (slots[i].key.volume != key->volume || slots[i].key.fileId != key->fileId))
+        i = (i + 1) & (capacity - 1);
+    return &slots[i];
+}
+
+/* Record the directory at path; key receives its identity for markVisitActive */
+static VisitState visitDirectory(const char *restrict path, VisitKey *key) {
+    HANDLE hDir = CreateFileA(path, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (hDir == INVALID_HANDLE_VALUE)
+        return VISIT_UNKNOWN;
+    BY_HANDLE_FILE_INFORMATION info;
+    BOOL ok = GetFileInformationByHandle(hDir, &info);
+    CloseHandle(hDir);
+    if (!ok)
+        return VISIT_UNKNOWN;
+    key->volume = info.dwVolumeSerialNumber;
+    key->fileId = ((ULONGLONG)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+
+    if ((g_visitedCount + 1) * 2 > g_visitedCapacity) {
+        size_t capacity = g_visitedCapacity ? g_visitedCapacity * 2 : 256;
+        VisitSlot *slots = (VisitSlot *)calloc(capacity, sizeof(VisitSlot));
+        if (!slots) {
+            fatalError("Memory allocation failed for visited directories.");
+            return VISIT_UNKNOWN;
+        }
+        for (size_t i = 0; i < g_visitedCapacity; i++) {
+            if (g_visited[i].used)
+                *findVisitSlot(slots, capacity, &g_visited[i].key) = g_visited[i];
+        }
+        free(g_visited);
+        g_visited = slots;
+        g_visitedCapacity = capacity;
+    }
+    VisitSlot *slot = findVisitSlot(g_visited, g_visitedCapacity, key);
+    if (slot->used)
+        return slot->active ? VISIT_CYCLE : VISIT_SEEN;
+    slot->used = 1;
+    slot->key = *key;
+    g_visitedCount++;
+    return VISIT_NEW;
+}
+
+static void markVisitActive(const VisitKey *key, int active) {
+    findVisitSlot(g_visited, g_visitedCapacity, key)->active = active;
+}
+
+static void resetVisited(void) {
+    free(g_visited);
+    g_visited = NULL;
+    g_visitedCount = g_visitedCapacity = 0;
+}
+
+/* Whether recursion may enter the directory entry data at all (links only with -L) */
+static inline int canDescend(const WIN32_FIND_DATAA *data) {
+    return (data->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+           (g_options.followLinks || !(data->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT));
+}
+
+/* -L check before reading a directory; returns 0 when it was listed already (see *state) */
+static int admitDirectory(const char *restrict path, VisitKey *key, VisitState *state) {
+    *state = g_options.followLinks ? visitDirectory(path, key) : VISIT_UNKNOWN;
+    return *state != VISIT_CYCLE && *state != VISIT_SEEN;
+}
+
+/* -L bookkeeping before listing a directory; returns 0 when it was listed already (see *state) */
+static int enterDirectory(const char *restrict path, VisitKey *key, VisitState *state) {
+    if (!admitDirectory(path, key, state))
+        return 0;
+    if (*state == VISIT_NEW)
+        markVisitActive(key, 1);
+    return 1;
+}
+
+static inline const char *visitNote(VisitState state) {
+    return state == VISIT_CYCLE ? "(cycle)" : "(listed elsewhere)";
+}
+
+static inline void leaveDirectory(const VisitKey *key, VisitState state) {
+    if (state == VISIT_NEW)
+        markVisitActive(key, 0);
+}
+
+static void listEntries(const char *restrict path, FileList *list, HANDLE hConsole, WORD defaultAttr, int depth);
+
+/* A subdirectory about to be listed; pruning and -L are settled before anything of it is read */
+typedef struct {
+    int pruned;
+    int admitted;        // Not pruned and not listed already
+    int read;            // list holds its entries, read ahead
+    VisitKey key;
+    VisitState state;
+    FileList list;
+} Subdir;
+
+/* Prune and -L checks for the subdirectory name at newPath */
+static void checkSubdir(const char *restrict newPath, const char *restrict name, Subdir *sub) {
+    sub->read = 0;
+    sub->state = VISIT_UNKNOWN;
+    sub->pruned = lkIsPruned(&g_options.lk, name);
+    sub->admitted = !sub->pruned && admitDirectory(newPath, &sub->key, &sub->state);
+}
+
+/*
+ * --inode-order: check subdirectories list->entries[indices[0..count)] in listing order,
+ * so -L keeps its first-listed-wins rule, then read the admitted ones in file ID order.
+ * When the request fails part way, the subdirectories not reached are left unread.
+ */
+static void readAheadSubdirs(const char *restrict path, const FileList *list, const size_t *indices, size_t count,
+                             Subdir *subdirs, IdOrder *order) {
+    char newPath[MAX_PATH];
+    for (size_t k = 0; k < count; k++) {
+        const char *name = list->entries[indices[k]].findData.cFileName;
+        subdirs[k].read = 0;
+        if (!requestFailed() && joinPath(path, name, newPath, MAX_PATH)) {
+            checkSubdir(newPath, name, &subdirs[k]);
+        } else {
+            subdirs[k].pruned = subdirs[k].admitted = 0;
+            subdirs[k].state = VISIT_UNKNOWN;
+        }
+    }
+    orderById(list, indices, 0, count, order);
+    for (size_t k = 0; k < count && !requestFailed(); k++) {
+        Subdir *sub = &subdirs[order[k].position];
+        if (!sub->admitted ||
+            !joinPath(path, list->entries[indices[order[k].position]].findData.cFileName, newPath, MAX_PATH) ||
+            !initFileList(&sub->list))
+            continue;
+        readDirectory(newPath, &sub->list);
+        sub->read = 1;
+        g_readAhead++;
+    }
+}
+
+/* Read path and list it; see listEntries */
+static void listDirectory(const char *restrict path, HANDLE hConsole, WORD defaultAttr, int depth) {
+    FileList list;
+    if (!initFileList(&list))
+        return;
+    readDirectory(path, &list);
+    listEntries(path, &list, hConsole, defaultAttr, depth);
+}
+
+/*
+ * Optimized listEntries:
+ * Merges the printing, summary computation, and recursion-directory collection loops
+ * into a single iteration over file entries, reducing redundant passes over the data.
+ * For recursive directory processing, directory indices are temporarily stored to
+ * minimize repeated scans of the file list. Depth limits and prune globs are checked
+ * before a subdirectory is opened, so skipped subtrees cost no system calls.
+ * Takes ownership of list, the already read entries of path.
+ */
+static void listEntries(const char *restrict path, FileList *list, HANDLE hConsole, WORD defaultAttr, int depth) {
+    if (requestFailed()) {
+        lkFreeFileList(list);
+        return;
+    }
+    lkSortFileList(&g_options.lk, list);
+    /* With --inode-order and -O, owners are looked up one batch of rows ahead of printing them */
+    const int prefetch = g_options.lk.inodeOrder && g_options.lk.longFormat && g_options.lk.showOwner;
+    char **owners = NULL;
+    size_t ownerCount = 0;
+    if (prefetch && list->count) {
+        owners = (char **)malloc(INODE_BATCH * sizeof(char *));
+        if (!owners) {
+            fatalError("Memory allocation failed for owner names.");
+            lkFreeFileList(list);
+            return;
+        }
+    }
+
+    printHeader(path);
+
+    // Allocate a temporary array to collect indices of directories for recursion.
+    size_t *recDirs = NULL;
+    size_t recCount = 0;
+    const int descend = g_options.lk.recursive && !g_options.lk.treeView && lkWithinDepth(&g_options.lk, depth + 1);
+    if (descend) {
+        recDirs = (size_t*)malloc(list->count * sizeof(size_t));
+        if (!recDirs) {
+            fatalError("Memory allocation failed for recursive directories array.");
+            free(owners);
+            lkFreeFileList(list);
+            return;
+        }
+    }
+
+    int dirCount = 0, fileCount = 0, shown = 0;
+    ULONGLONG totalSize = 0;
+    for (size_t i = 0; i < list->count && !requestFailed(); ++i) {
+        /* Directories that failed the predicates are only here to be descended into */
+        const int matched = !(list->entries[i].flags & LK_ENTRY_TRAVERSE_ONLY);
+        if (owners && i % INODE_BATCH == 0) {
+            freeOwners(owners, ownerCount);
+            ownerCount = list->count - i < INODE_BATCH ? list->count - i : INODE_BATCH;
+            prefetchOwners(path, list, i, ownerCount, owners);
+        }
+        if (matched)
+            printFileEntry(path, ++shown, &list->entries[i], owners ? owners[i % INODE_BATCH] : NULL, hConsole, defaultAttr);
+        const WIN32_FIND_DATAA *data = &list->entries[i].findData;
+        if (data->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            dirCount += matched;
+            if (descend && canDescend(data)) {
+                recDirs[recCount++] = i;
+            }
+        } else {
+            ++fileCount;
+            ULARGE_INTEGER fileSize;
+            fileSize.LowPart = data->nFileSizeLow;
+            fileSize.HighPart = data->nFileSizeHigh;
+            totalSize += fileSize.QuadPart;
+        }
+    }
+
+    if (g_options.lk.showSummary && !requestFailed()) {
+        char sizeStr[32] = {0};
+        lkFormatSize(totalSize, sizeStr, sizeof(sizeStr), g_options.lk.humanSize);
+        printOut("\nSummary: %d directories, %d files, total size: %s\n", 
+               dirCount, fileCount, sizeStr);
+    }
+
+    if (owners) {
+        freeOwners(owners, ownerCount);
+        free(owners);
+    }
+
+    if (descend) {
+        /*
+         * With --inode-order a batch of subdirectories is read up front, in file ID order,
+         * as far as the read-ahead budget allows; without room left they are read one by one
+         */
+        Subdir *subdirs = NULL;
+        IdOrder *order = NULL;   /* On the heap: this frame recurses */
+        size_t capacity = 0;
+        if (g_options.lk.inodeOrder && recCount > 1 && g_readAhead + 1 < INODE_BATCH) {
+            capacity = recCount < INODE_BATCH ? recCount : INODE_BATCH;
+            subdirs = (Subdir *)malloc(capacity * sizeof(Subdir));
+            order = (IdOrder *)malloc(capacity * sizeof(IdOrder));
+            if (!subdirs || !order) {
+                fatalError("Memory allocation failed for subdirectory lists.");
+                recCount = 0;
+            }
+        }
+        size_t first = 0, batch = 0;   // subdirs[0..batch) describe recDirs[first..first + batch)
+        size_t i;
+        for (i = 0; i < recCount && !requestFailed(); i++) {
+            if (i >= first + batch) {
+                first = i;
+                batch = recCount - i < capacity ? recCount - i : capacity;
+                if (batch > INODE_BATCH - g_readAhead)
+                    batch = INODE_BATCH - g_readAhead;
+                if (batch > 1)
+                    readAheadSubdirs(path, list, recDirs + i, batch, subdirs, order);
+                else
+                    batch = 0;
+                if (requestFailed())
+                    break;
+            }
+            const WIN32_FIND_DATAA *data = &list->entries[recDirs[i]].findData;
+            char newPath[MAX_PATH] = {0};
+            if (!joinPath(path, data->cFileName, newPath, MAX_PATH))
+                break;
+            Subdir single;
+            Subdir *sub = batch ? &subdirs[i - first] : &single;
+            if (!batch)
+                checkSubdir(newPath, data->cFileName, sub);
+            /* Pruned directories collapse to a single line instead of a full section */
+            if (sub->pruned) {
+                printOut("\n[%s]: (pruned)\n", newPath);
+                continue;
+            }
+            if (!sub->admitted) {
+                printOut("\n[%s]: %s\n", newPath, visitNote(sub->state));
+                continue;
+            }
+            if (sub->state == VISIT_NEW)
+                markVisitActive(&sub->key, 1);
+            if (sub->read) {
+                /* Listing it takes ownership; from here on it counts as an open directory, not read-ahead */
+                g_readAhead--;
+                listEntries(newPath, &sub->list, hConsole, defaultAttr, depth + 1);
+            } else {
+                listDirectory(newPath, hConsole, defaultAttr, depth + 1);
+            }
+            leaveDirectory(&sub->key, sub->state);
+        }
+        /* A failed request leaves the rest of the batch read ahead but never listed */
+        for (size_t k = i - first; k < batch; k++) {
+            if (subdirs[k].read) {
+                lkFreeFileList(&subdirs[k].list);
+                g_readAhead--;
+            }
+        }
+        free(order);
+        free(subdirs);
+        free(recDirs);
+    }
+    lkFreeFileList(list);
+}
+
+/* List a single directory entry (not its contents) */
+static void listDirectorySelf(const char *restrict path, HANDLE hConsole, WORD defaultAttr) {
+    WIN32_FIND_DATAA data;
+    HANDLE hFind = FindFirstFileA(path, &data);
+    if (hFind == INVALID_HANDLE_VALUE) {
+        printErr("Error: Unable to retrieve info for '%s' (Error code: %lu)\n", path, GetLastError());
+        return;
+    }
+    FindClose(hFind);
+    printHeader(path);
+    FileEntry entry;
+    entry.findData = data;
+    entry.flags = 0;
+    entry.fileId = 0;
+    printFileEntry(path, 1, &entry, NULL, hConsole, defaultAttr);
+}
+
+/* Corrected treeDirectory: Adds recursion depth limit and skips reparse points to ensure system resilience */
 static void treeDirectory(const char *restrict path, HANDLE hConsole, WORD defaultAttr, int indent) {
     /* Limit recursion depth to avoid potential stack overflow */
     if (indent >= 31)
         return;
 
-    FileList list;
-    initFileList(&list);
-    readDirectory(path, &list);
-    
-    if (list.count > 1)
-        qsort(list.entries, list.count, sizeof(FileEntry), compareEntries);
-    
-    const char *indentBuf = getIndentString(indent);
-    for (size_t i = 0; i < list.count; i++) {
-        const WIN32_FIND_DATAA *data = &list.entries[i].findData;
-        char typeIndicator = (data->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? 'D' : 'F';
-        if (data->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
-            typeIndicator = '@';
-        printf("%s|- [%c] %s\n", indentBuf, typeIndicator, data->cFileName);
+    FileList list;
+    if (!initFileList(&list))
+        return;
+    readDirectory(path, &list);
+    lkSortFileList(&g_options.lk, &list);
+    
+    const int descend = g_options.lk.recursive && lkWithinDepth(&g_options.lk, indent + 1);
+    const char *indentBuf = getIndentString(indent);
+    /* Directories that failed the predicates are still drawn so matches keep their place in the tree */
+    for (size_t i = 0; i < list.count && !requestFailed(); i++) {
+        const WIN32_FIND_DATAA *data = &list.entries[i].findData;
+        char typeIndicator = (data->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? 'D' : 'F';
+        if (data->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+            typeIndicator = '@';
+        if (descend && typeIndicator == 'D' && lkIsPruned(&g_options.lk, data->cFileName))
+            printOut("%s|- [%c] %s (pruned)\n", indentBuf, typeIndicator, data->cFileName);
+        else
+            printOut("%s|- [%c] %s\n", indentBuf, typeIndicator, data->cFileName);
+    }
+   
+    if (descend) {
+        for (size_t i = 0; i < list.count && !requestFailed(); i++) {
+            const WIN32_FIND_DATAA *data = &list.entries[i].findData;
+            /* Reparse points are only entered with -L, which guards against cycles */
+            if (canDescend(data) && !lkIsPruned(&g_options.lk, data->cFileName)) {
+                char newPath[MAX_PATH];
+                if (!joinPath(path, data->cFileName, newPath, MAX_PATH))
+                    break;
+                printOut("%s|\n", indentBuf);
+                VisitKey key;
+                VisitState state;
+                if (!enterDirectory(newPath, &key, &state)) {
+                    printOut("%s|- %s\n", getIndentString(indent + 1), visitNote(state));
+                    continue;
+                }
+                treeDirectory(newPath, hConsole, defaultAttr, indent + 1);
+                leaveDirectory(&key, state);
+            }
+        }
+    }
+    lkFreeFileList(&list);
+}
+
+/*
+ * --analyze: streaming statistics over a whole tree.
+ * No FileList is kept; each directory is enumerated through lkEnumerateDirectory and
+ * only the names of its subdirectories are held until they have been visited. The
+ * root's subdirectories are shared out to worker threads, each filling its own LkStats,
+ * and the per-thread accumulators are merged at the end.
+ */
+#define ANALYZE_MAX_THREADS 8
+
+typedef struct {
+    const LkOptions *options;   // The listing's options; analysis threads have no g_options of their own
+    LkStats *stats;
+    char *names;          // Subdirectory names to visit, '\0'-separated
+    size_t used;
+    size_t capacity;
+    ULONGLONG files;      // Files directly inside the directory
+    ULONGLONG bytes;
+    int descend;
+    ULONGLONG deadline;   // --estimate: GetTickCount64 value at which to stop reading (0 = none)
+    ULONGLONG seen;       // Entries delivered, for spacing the deadline checks
+    int expired;          // The enumeration was cut short by deadline
+} AnalyzeContext;
+
+static int analyzeEntry(void *context, const FileEntry *entry) {
+    AnalyzeContext *ctx = (AnalyzeContext *)context;
+    const WIN32_FIND_DATAA *data = &entry->findData;
+    /* The clock is read every 1024 entries, so a huge directory cannot overrun the deadline by much */
+    if (ctx->deadline && (++ctx->seen & 1023) == 0 && GetTickCount64() >= ctx->deadline) {
+        ctx->expired = 1;
+        return 0;
+    }
+    if (!(data->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        lkStatsAddFile(ctx->stats, entry);
+        ctx->files++;
+        ctx->bytes += (((ULONGLONG)data->nFileSizeHigh) << 32) | data->nFileSizeLow;
+        return 1;
+    }
+    if (!(entry->flags & LK_ENTRY_TRAVERSE_ONLY))
+        ctx->stats->dirs++;
+    if (!ctx->descend || (data->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) ||
+        lkIsPruned(ctx->options, data->cFileName))
+        return 1;
+    size_t len = strlen(data->cFileName) + 1;
+    if (ctx->used + len > ctx->capacity) {
+        size_t newCapacity = ctx->capacity ? ctx->capacity * 2 : 4096;
+        while (newCapacity < ctx->used + len)
+            newCapacity *= 2;
+        char *temp = (char *)realloc(ctx->names, newCapacity);
+        if (!temp) {
+            fatalError("Memory allocation failed for subdirectory names.");
+            return 0;
+        }
+        ctx->names = temp;
+        ctx->capacity = newCapacity;
+    }
+    memcpy(ctx->names + ctx->used, data->cFileName, len);
+    ctx->used += len;
+    return 1;
+}
+
+/* Accumulate path and everything below it into stats */
+static void analyzeWalk(const LkOptions *options, LkStats *stats, const char *restrict path, int depth) {
+    AnalyzeContext ctx = { options, stats, NULL, 0, 0, 0, 0, lkWithinDepth(options, depth + 1), 0, 0, 0 };
+    if (!lkEnumerateDirectory(options, path, analyzeEntry, &ctx)) {
+        stats->unreadable++;
+        free(ctx.names);
+        return;
+    }
+    lkStatsAddDirectory(stats, path, ctx.files, ctx.bytes);
+    for (size_t offset = 0; offset < ctx.used && !requestFailed(); offset += strlen(ctx.names + offset) + 1) {
+        char newPath[MAX_PATH];
+        if (!joinPath(path, ctx.names + offset, newPath, MAX_PATH))
+            break;
+        analyzeWalk(options, stats, newPath, depth + 1);
+    }
+    free(ctx.names);
+}
+
+/* Work shared by the analysis threads: the root's subdirectories, handed out in order */
+typedef struct {
+    const char *root;
+    const char *names;
+    const size_t *offsets;
+    LONG count;
+    volatile LONG next;
+    const LkOptions *options;
+    Request *request;     // The --serve request the analysis runs for, or NULL
+} AnalyzeQueue;
+
+typedef struct {
+    AnalyzeQueue *queue;
+    LkStats *stats;
+} AnalyzeWorker;
+
+static DWORD WINAPI analyzeThread(LPVOID param) {
+    AnalyzeWorker *worker = (AnalyzeWorker *)param;
+    AnalyzeQueue *queue = worker->queue;
+    /* Errors on a worker fail the request it works for, as they would on the request's own thread */
+    t_request = queue->request;
+    LONG index;
+    while (!requestFailed() && (index = InterlockedIncrement(&queue->next) - 1) < queue->count) {
+        char newPath[MAX_PATH];
+        if (joinPath(queue->root, queue->names + queue->offsets[index], newPath, MAX_PATH))
+            analyzeWalk(queue->options, worker->stats, newPath, 1);
+    }
+    return 0;
+}
+
+/* Compare extension slots by bytes, then by file count, descending */
+static int compareExtByBytes(const void *a, const void *b) {
+    const LkExtStat *ea = (const LkExtStat *)a, *eb = (const LkExtStat *)b;
+    if (ea->bytes != eb->bytes)
+        return ea->bytes < eb->bytes ? 1 : -1;
+    return ea->files < eb->files ? 1 : (ea->files > eb->files ? -1 : 0);
+}
+
+static int compareExtByFiles(const void *a, const void *b) {
+    const LkExtStat *ea = (const LkExtStat *)a, *eb = (const LkExtStat *)b;
+    if (ea->files != eb->files)
+        return ea->files < eb->files ? 1 : -1;
+    return ea->bytes < eb->bytes ? 1 : (ea->bytes > eb->bytes ? -1 : 0);
+}
+
+static int compareDirByBytes(const void *a, const void *b) {
+    const LkDirStat *da = (const LkDirStat *)a, *db = (const LkDirStat *)b;
+    return da->bytes < db->bytes ? 1 : (da->bytes > db->bytes ? -1 : 0);
+}
+
+static inline double percentOf(ULONGLONG part, ULONGLONG whole) {
+    return whole ? 100.0 * (double)part / (double)whole : 0.0;
+}
+
+/* Print one "label  files  bytes  percent" row of the analysis report */
+static void printAnalyzeRow(const char *restrict label, ULONGLONG files, ULONGLONG bytes, const LkStats *stats) {
+    char sizeStr[32];
+    lkFormatSize(bytes, sizeStr, sizeof(sizeStr), g_options.lk.humanSize);
+    printOut("  %-20s %12llu %12s %6.1f%%\n", label, files, sizeStr, percentOf(bytes, stats->bytes));
+}
+
+static void printAnalysis(const LkStats *stats) {
+    char sizeStr[32], lowStr[32], highStr[32], label[64];
+    lkFormatSize(stats->bytes, sizeStr, sizeof(sizeStr), g_options.lk.humanSize);
+    printOut("\nTotals: %llu directories, %llu files, total size: %s", stats->dirs, stats->files, sizeStr);
+    if (stats->unreadable)
+        printOut(" (%llu unreadable directories)", stats->unreadable);
+    printOut("\n");
+
+    printOut("\nSize histogram:\n  %-20s %12s %12s %7s\n", "Range", "Files", "Size", "Bytes");
+    for (int i = 0; i < LK_SIZE_BUCKETS; i++) {
+        if (!stats->sizeFiles[i])
+            continue;
+        if (i == 0) {
+            strcpy(label, "0");
+        } else {
+            lkFormatSize(1ULL << (i - 1), lowStr, sizeof(lowStr), 1);
+            if (i < 64)
+                lkFormatSize(1ULL << i, highStr, sizeof(highStr), 1);
+            else
+                strcpy(highStr, "max");
+            snprintf(label, sizeof(label), "%s - %s", lowStr, highStr);
+        }
+        printAnalyzeRow(label, stats->sizeFiles[i], stats->sizeBytes[i], stats);
+    }
+
+    static const char *ageLabels[LK_AGE_BUCKETS] = {
+        "< 1 day", "< 1 week", "< 1 month", "< 1 year", "< 5 years", ">= 5 years"
+    };
+    printOut("\nAge (last modified):\n  %-20s %12s %12s %7s\n", "Age", "Files", "Size", "Bytes");
+    for (int i = 0; i < LK_AGE_BUCKETS; i++)
+        printAnalyzeRow(ageLabels[i], stats->ageFiles[i], stats->ageBytes[i], stats);
+
+    /* Compact the used extension slots so they can be ranked */
+    LkExtStat *exts = (LkExtStat *)malloc((stats->extCount + 1) * sizeof(LkExtStat));
+    if (!exts) {
+        fatalError("Memory allocation failed for extension report.");
+        return;
+    }
+    size_t extCount = 0;
+    for (size_t i = 0; i < LK_EXT_SLOTS; i++) {
+        if (stats->exts[i].files)
+            exts[extCount++] = stats->exts[i];
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        qsort(exts, extCount, sizeof(LkExtStat), pass ? compareExtByFiles : compareExtByBytes);
+        printOut("\nTop extensions by %s:\n  %-20s %12s %12s %7s\n", pass ? "count" : "size",
+               "Extension", "Files", "Size", "Bytes");
+        for (size_t i = 0; i < extCount && i < 10; i++) {
+            if (exts[i].ext[0])
+                snprintf(label, sizeof(label), ".%s", exts[i].ext);
+            else
+                strcpy(label, "(none)");
+            printAnalyzeRow(label, exts[i].files, exts[i].bytes, stats);
+        }
+        if (stats->otherExtFiles)
+            printAnalyzeRow("(other)", stats->otherExtFiles, stats->otherExtBytes, stats);
+    }
+    free(exts);
+
+    LkDirStat topDirs[LK_TOP_DIRS];
+    memcpy(topDirs, stats->topDirs, stats->topDirCount * sizeof(LkDirStat));
+    qsort(topDirs, stats->topDirCount, sizeof(LkDirStat), compareDirByBytes);
+    printOut("\nLargest directories (files directly inside):\n");
+    for (size_t i = 0; i < stats->topDirCount; i++) {
+        lkFormatSize(topDirs[i].bytes, sizeStr, sizeof(sizeStr), g_options.lk.humanSize);
+        printOut("  %12s %10llu files  %s\n", sizeStr, topDirs[i].files, topDirs[i].path);
+    }
+}
+
+/* --analyze entry point for one root path */
+static void analyzeDirectory(const char *restrict path) {
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    LkStats *total = (LkStats *)malloc(sizeof(LkStats));
+    if (!total) {
+        fatalError("Memory allocation failed for statistics.");
+        return;
+    }
+    lkStatsInit(total, &now);
+
+    /* The root is walked inline; its subdirectories become the shared work list */
+    AnalyzeContext ctx = { &g_options.lk, total, NULL, 0, 0, 0, 0, lkWithinDepth(&g_options.lk, 1), 0, 0, 0 };
+    if (!lkEnumerateDirectory(&g_options.lk, path, analyzeEntry, &ctx) || requestFailed()) {
+        if (!requestFailed())
+            printErr("Error: Unable to open directory '%s' (Error code: %lu)\n", path, GetLastError());
+        free(ctx.names);
+        free(total);
+        return;
+    }
+    lkStatsAddDirectory(total, path, ctx.files, ctx.bytes);
+
+    size_t count = 0;
+    for (size_t offset = 0; offset < ctx.used; offset += strlen(ctx.names + offset) + 1)
+        count++;
+    size_t *offsets = (size_t *)malloc((count + 1) * sizeof(size_t));
+    if (!offsets) {
+        fatalError("Memory allocation failed for analysis work list.");
+        free(ctx.names);
+        free(total);
+        return;
+    }
+    count = 0;
+    for (size_t offset = 0; offset < ctx.used; offset += strlen(ctx.names + offset) + 1)
+        offsets[count++] = offset;
+
+    AnalyzeQueue queue = { path, ctx.names, offsets, (LONG)count, 0, &g_options.lk, t_request };
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    /* The calling thread works the queue too, so start one thread fewer than there are processors */
+    size_t threadCount = si.dwNumberOfProcessors ? si.dwNumberOfProcessors - 1 : 0;
+    if (threadCount > ANALYZE_MAX_THREADS)
+        threadCount = ANALYZE_MAX_THREADS;
+    if (threadCount > count)
+        threadCount = count;
+
+    AnalyzeWorker workers[ANALYZE_MAX_THREADS];
+    HANDLE threads[ANALYZE_MAX_THREADS];
+    size_t started = 0;
+    for (size_t i = 0; i < threadCount; i++) {
+        workers[i].queue = &queue;
+        workers[i].stats = (LkStats *)malloc(sizeof(LkStats));
+        if (!workers[i].stats) {
+            fatalError("Memory allocation failed for statistics.");
+            break;
+        }
+        lkStatsInit(workers[i].stats, &now);
+        threads[i] = CreateThread(NULL, 0, analyzeThread, &workers[i], 0, NULL);
+        if (!threads[i]) {
+            free(workers[i].stats);
+            break;
+        }
+        started++;
+    }
+    /* Whatever the workers did not pick up (or all of it, without threads) runs here */
+    AnalyzeWorker self = { &queue, total };
+    analyzeThread(&self);
+
+    for (size_t i = 0; i < started; i++) {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+        lkStatsMerge(total, workers[i].stats);
+        free(workers[i].stats);
+    }
+
+    if (!requestFailed()) {
+        char absPath[MAX_PATH] = {0};
+        if (!GetFullPathNameA(path, MAX_PATH, absPath, NULL))
+            strncpy(absPath, path, MAX_PATH - 1);
+        printOut("\n[%s]: analysis\n", absPath);
+        printAnalysis(total);
+    }
+
+    free(offsets);
+    free(ctx.names);
+    free(total);
+}
+
+/*
+ * --estimate: approximate tree totals within a time budget.
+ * Directories are read exactly, breadth first, for up to a quarter of the budget; a tree
+ * that fits in that time is reported exactly and nothing is sampled. Otherwise every
+ * directory left unread at that point roots a disjoint subtree, and for the rest of the
+ * budget random walks (Knuth's estimator) start at a uniformly chosen one of them and
+ * descend through uniformly chosen subdirectories, weighting what each level holds by
+ * the inverse of the probability of reaching it.
+ * Each walk is an unbiased estimate of everything below the frontier, so their mean
+ * plus the exact part estimates the whole tree, and their spread gives the interval.
+ */
+typedef struct {
+    char *path;
+    int depth;
+} EstimateDir;
+
+/* Running mean and variance of the walk results (Welford's method) */
+typedef struct {
+    ULONGLONG count;
+    double mean[3];       // Directories, files, bytes
+    double m2[3];
+} EstimateSamples;
+
+static void addEstimateSample(EstimateSamples *samples, const double value[3]) {
+    samples->count++;
+    for (int i = 0; i < 3; i++) {
+        double delta = value[i] - samples->mean[i];
+        samples->mean[i] += delta / (double)samples->count;
+        samples->m2[i] += delta * (value[i] - samples->mean[i]);
+    }
+}
+
+/* xorshift64*: quality is ample for choosing subdirectories */
+static ULONGLONG nextRandom(ULONGLONG *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+/*
+ * Read one directory: directory entries counted in scratch->dirs, files, bytes and subdirectory
+ * names in ctx. Stops at deadline with ctx->expired set, leaving the counts incomplete.
+ */
+static int estimateRead(const char *restrict path, int depth, ULONGLONG deadline, LkStats *scratch, AnalyzeContext *ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->options = &g_options.lk;
+    ctx->stats = scratch;
+    ctx->deadline = deadline;
+    ctx->descend = lkWithinDepth(&g_options.lk, depth + 1);
+    scratch->dirs = 0;
+    return lkEnumerateDirectory(&g_options.lk, path, analyzeEntry, ctx);
+}
+
+static void printEstimateRow(const char *restrict label, double exact, const EstimateSamples *samples, int index, int isSize) {
+    double total = exact + samples->mean[index];
+    double half = samples->count > 1 ? 1.96 * sqrt(samples->m2[index] / (double)(samples->count - 1) / (double)samples->count) : 0;
+    double low = total - half < exact ? exact : total - half;
+    char totalStr[32], lowStr[32], highStr[32];
+    if (isSize) {
+        lkFormatSize((ULONGLONG)total, totalStr, sizeof(totalStr), g_options.lk.humanSize);
+        lkFormatSize((ULONGLONG)low, lowStr, sizeof(lowStr), g_options.lk.humanSize);
+        lkFormatSize((ULONGLONG)(total + half), highStr, sizeof(highStr), g_options.lk.humanSize);
+    } else {
+        snprintf(totalStr, sizeof(totalStr), "%.0f", total);
+        snprintf(lowStr, sizeof(lowStr), "%.0f", low);
+        snprintf(highStr, sizeof(highStr), "%.0f", total + half);
+    }
+    if (samples->count > 1)
+        printOut("  %-12s ~%s (95%% interval %s - %s)\n", label, totalStr, lowStr, highStr);
+    else
+        printOut("  %-12s %s%s\n", label, samples->count ? "~" : "", totalStr);
+}
+
+static void estimateDirectory(const char *restrict path) {
+    const ULONGLONG start = GetTickCount64();
+    const ULONGLONG budget = (ULONGLONG)g_options.estimateSeconds * 1000;
+    const ULONGLONG deadline = start + budget;
+    LkStats *scratch = (LkStats *)malloc(sizeof(LkStats));
+    if (!scratch) {
+        fatalError("Memory allocation failed for statistics.");
+        return;
+    }
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    lkStatsInit(scratch, &now);
+
+    /* Exact phase: a FIFO over queue[head..count) */
+    size_t head = 0, count = 1, capacity = 256;
+    EstimateDir *queue = (EstimateDir *)malloc(capacity * sizeof(EstimateDir));
+    if (!queue || !(queue[0].path = _strdup(path))) {
+        fatalError("Memory allocation failed for estimate queue.");
+        free(queue);
+        free(scratch);
+        return;
+    }
+    queue[0].depth = 0;
+    double exact[3] = { 0, 0, 0 };
+    ULONGLONG exactRead = 0, unreadable = 0;
+    int truncated = 0;   // The budget ran out inside an exact read: the totals are a lower bound
+    while (head < count && GetTickCount64() - start < budget / 4 && !requestFailed()) {
+        EstimateDir dir = queue[head++];
+        AnalyzeContext ctx;
+        if (!estimateRead(dir.path, dir.depth, deadline, scratch, &ctx)) {
+            unreadable++;
+        } else {
+            truncated |= ctx.expired;
+            exactRead++;
+            exact[0] += (double)scratch->dirs;
+            exact[1] += (double)ctx.files;
+            exact[2] += (double)ctx.bytes;
+            for (size_t offset = 0; offset < ctx.used; offset += strlen(ctx.names + offset) + 1) {
+                if (count == capacity) {
+                    EstimateDir *temp = (EstimateDir *)realloc(queue, capacity * 2 * sizeof(EstimateDir));
+                    if (!temp) {
+                        fatalError("Memory allocation failed for estimate queue.");
+                        break;
+                    }
+                    queue = temp;
+                    capacity *= 2;
+                }
+                char newPath[MAX_PATH];
+                if (!joinPath(dir.path, ctx.names + offset, newPath, MAX_PATH))
+                    break;
+                if (!(queue[count].path = _strdup(newPath))) {
+                    fatalError("Memory allocation failed for estimate queue.");
+                    break;
+                }
+                queue[count++].depth = dir.depth + 1;
+            }
+        }
+        free(ctx.names);
+        free(dir.path);
+    }
+
+    /* Sampling phase: walks from random frontier directories until the budget is spent */
+    EstimateSamples samples;
+    memset(&samples, 0, sizeof(samples));
+    const EstimateDir *frontier = queue + head;
+    const size_t frontierCount = count - head;
+    LARGE_INTEGER seed;
+    QueryPerformanceCounter(&seed);
+    ULONGLONG rng = (ULONGLONG)seed.QuadPart | 1;
+    while (frontierCount && !truncated && GetTickCount64() < deadline && !requestFailed()) {
+        const EstimateDir *first = &frontier[nextRandom(&rng) % frontierCount];
+        double weight = (double)frontierCount, value[3] = { 0, 0, 0 };
+        char current[MAX_PATH];
+        strcpy(current, first->path);
+        /* A walk the deadline cuts short is incomplete and would bias the mean; it is dropped */
+        int complete = 1;
+        for (int depth = first->depth;; depth++) {
+            AnalyzeContext ctx;
+            if (GetTickCount64() >= deadline) {
+                complete = 0;
+                break;
+            }
+            if (!estimateRead(current, depth, deadline, scratch, &ctx)) {
+                free(ctx.names);
+                break;
+            }
+            if (ctx.expired) {
+                free(ctx.names);
+                complete = 0;
+                break;
+            }
+            value[0] += weight * (double)scratch->dirs;
+            value[1] += weight * (double)ctx.files;
+            value[2] += weight * (double)ctx.bytes;
+            size_t children = 0;
+            for (size_t offset = 0; offset < ctx.used; offset += strlen(ctx.names + offset) + 1)
+                children++;
+            if (!children) {
+                free(ctx.names);
+                break;
+            }
+            size_t pick = (size_t)(nextRandom(&rng) % children), offset = 0;
+            while (pick--)
+                offset += strlen(ctx.names + offset) + 1;
+            char next[MAX_PATH];
+            if (!joinPath(current, ctx.names + offset, next, MAX_PATH)) {
+                free(ctx.names);
+                complete = 0;
+                break;
+            }
+            strcpy(current, next);
+            weight *= (double)children;
+            free(ctx.names);
+        }
+        if (complete)
+            addEstimateSample(&samples, value);
+    }
+
+    if (!requestFailed()) {
+        char absPath[MAX_PATH] = {0};
+        if (!GetFullPathNameA(path, MAX_PATH, absPath, NULL))
+            strncpy(absPath, path, MAX_PATH - 1);
+        printOut("\n[%s]: %s after %.1f s (%llu directories read exactly, %llu sample walks)\n",
+               absPath, frontierCount ? "estimate" : "exact totals", (double)(GetTickCount64() - start) / 1000.0,
+               exactRead, samples.count);
+        if (truncated)
+            printOut("  Time ran out while reading a directory near the root; the totals are a lower bound.\n");
+        else if (frontierCount && samples.count < 2)
+            printOut("  Too few samples for an interval; allow more time.\n");
+        printEstimateRow("Directories:", exact[0], &samples, 0, 0);
+        printEstimateRow("Files:", exact[1], &samples, 1, 0);
+        printEstimateRow("Total size:", exact[2], &samples, 2, 1);
+        if (unreadable)
+            printOut("  (%llu unreadable directories near the root)\n", unreadable);
+    }
+
+    for (size_t i = head; i < count; i++)
+        free(queue[i].path);
+    free(queue);
+    free(scratch);
+}
+
+/*
+ * --diff: compare two trees one directory pair at a time.
+ * Each pair is enumerated in parallel (side B on a helper thread), both lists are sorted
+ * with lkSortFileList by name and merge-joined, and the differences are printed as they
+ * are found. Only directories present on both sides are descended into, and the two
+ * FileLists are reused for every pair, so memory stays at one directory per side.
+ */
+typedef struct {
+    HANDLE hRequest;      // Signaled by the caller when path is ready to be read
+    HANDLE hDone;         // Signaled by the helper when list is filled
+    HANDLE hThread;       // NULL when the helper could not be started
+    const LkOptions *options;
+    char path[MAX_PATH];
+    FileList list;
+    int ok;
+    DWORD error;
+    volatile int quit;
+} DiffReader;
+
+typedef struct {
+    LkOptions options;    // g_options reduced to a case-insensitive name order, without predicates
+    const LkOptions *match;   // Options whose predicates decide which pairs are reported
+    DiffReader reader;    // Reads side B
+    FileList list;        // Side A
+    ULONGLONG added, removed, changed;
+} DiffContext;
+
+/* Read and sort one directory into list; returns 1 on success */
+static int diffReadSide(const LkOptions *options, const char *restrict path, FileList *list) {
+    list->count = 0;
+    if (!lkReadDirectory(options, path, list))
+        return 0;
+    lkSortFileList(options, list);
+    return 1;
+}
+
+static DWORD WINAPI diffReaderThread(LPVOID param) {
+    DiffReader *reader = (DiffReader *)param;
+    for (;;) {
+        WaitForSingleObject(reader->hRequest, INFINITE);
+        if (reader->quit)
+            return 0;
+        reader->ok = diffReadSide(reader->options, reader->path, &reader->list);
+        reader->error = reader->ok ? 0 : GetLastError();
+        SetEvent(reader->hDone);
     }
-   
-    if (g_options.recursive) {
-        for (size_t i = 0; i < list.count; i++) {
-            const WIN32_FIND_DATAA *data = &list.entries[i].findData;
-            /* Prevent recursion into reparse points to avoid cyclic directory traversal */
-            if ((data->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
-                !(data->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
-                char newPath[MAX_PATH];
-                joinPath(path, data->cFileName, newPath, MAX_PATH);
-                printf("%s|\n", indentBuf);
-                treeDirectory(newPath, hConsole, defaultAttr, indent + 1);
+}
+
+/* Fill ctx->list from pathA and ctx->reader.list from pathB, concurrently when possible */
+static int diffReadPair(DiffContext *ctx, const char *restrict pathA, const char *restrict pathB) {
+    DiffReader *reader = &ctx->reader;
+    strcpy(reader->path, pathB);
+    if (reader->hThread)
+        SetEvent(reader->hRequest);
+    int okA = diffReadSide(&ctx->options, pathA, &ctx->list);
+    DWORD errorA = okA ? 0 : GetLastError();
+    if (reader->hThread) {
+        WaitForSingleObject(reader->hDone, INFINITE);
+    } else {
+        reader->ok = diffReadSide(&ctx->options, pathB, &reader->list);
+        reader->error = reader->ok ? 0 : GetLastError();
+    }
+    if (!okA) {
+        SetLastError(errorA);
+        if (errorA == ERROR_NOT_ENOUGH_MEMORY)
+            fatalError("Memory reallocation failed for FileList.");
+        else
+            printErr("Error: Unable to open directory '%s' (Error code: %lu)\n", pathA, errorA);
+    }
+    if (!reader->ok && !requestFailed()) {
+        SetLastError(reader->error);
+        if (reader->error == ERROR_NOT_ENOUGH_MEMORY)
+            fatalError("Memory reallocation failed for FileList.");
+        else
+            printErr("Error: Unable to open directory '%s' (Error code: %lu)\n", pathB, reader->error);
+    }
+    return okA && reader->ok;
+}
+
+static inline ULONGLONG entrySize(const WIN32_FIND_DATAA *data) {
+    return (((ULONGLONG)data->nFileSizeHigh) << 32) | data->nFileSizeLow;
+}
+
+/* Print one "~" line describing how a matched pair of entries differs */
+static void printDiffChange(const char *restrict rel, const WIN32_FIND_DATAA *a, const WIN32_FIND_DATAA *b) {
+    const int aIsDir = (a->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    const int bIsDir = (b->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    printOut("~ %s", rel);
+    if (aIsDir != bIsDir) {
+        printOut("  (%s -> %s)\n", aIsDir ? "directory" : "file", bIsDir ? "directory" : "file");
+        return;
+    }
+    ULONGLONG sizeA = entrySize(a), sizeB = entrySize(b);
+    if (sizeA != sizeB) {
+        char sizeStrA[32], sizeStrB[32];
+        lkFormatSize(sizeA, sizeStrA, sizeof(sizeStrA), g_options.lk.humanSize);
+        lkFormatSize(sizeB, sizeStrB, sizeof(sizeStrB), g_options.lk.humanSize);
+        printOut("  size %s -> %s", sizeStrA, sizeStrB);
+    }
+    if (CompareFileTime(&a->ftLastWriteTime, &b->ftLastWriteTime)) {
+        char timeStrA[32], timeStrB[32];
+        fileTimeToString(&a->ftLastWriteTime, timeStrA, sizeof(timeStrA));
+        fileTimeToString(&b->ftLastWriteTime, timeStrB, sizeof(timeStrB));
+        printOut("  modified %s -> %s", timeStrA, timeStrB);
+    }
+    printOut("\n");
+}
+
+/* Compare pathA with pathB; rel is the path of both relative to the roots ("" at the top) */
+static void diffDirectory(DiffContext *ctx, const char *restrict pathA, const char *restrict pathB,
+                          const char *restrict rel, int depth) {
+    if (!diffReadPair(ctx, pathA, pathB))
+        return;
+
+    const FileList *listA = &ctx->list;
+    const FileList *listB = &ctx->reader.list;
+    const int descend = lkWithinDepth(&ctx->options, depth + 1);
+    char *names = NULL;   // Directories present on both sides, '\0'-separated
+    size_t used = 0, capacity = 0;
+    size_t i = 0, j = 0;
+    while ((i < listA->count || j < listB->count) && !requestFailed()) {
+        const WIN32_FIND_DATAA *a = i < listA->count ? &listA->entries[i].findData : NULL;
+        const WIN32_FIND_DATAA *b = j < listB->count ? &listB->entries[j].findData : NULL;
+        int cmp = !a ? 1 : (!b ? -1 : _stricmp(a->cFileName, b->cFileName));
+        char relPath[MAX_PATH];
+        /* The lists are unfiltered: predicates decide what is reported, not what is descended into */
+        if (cmp < 0) {
+            if (lkMatchPredicates(ctx->match, pathA, &listA->entries[i]) &&
+                joinPath(rel, a->cFileName, relPath, MAX_PATH)) {
+                printOut("- %s%s\n", relPath, (a->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? "\\" : "");
+                ctx->removed++;
+            }
+            i++;
+            continue;
+        }
+        if (cmp > 0) {
+            if (lkMatchPredicates(ctx->match, pathB, &listB->entries[j]) &&
+                joinPath(rel, b->cFileName, relPath, MAX_PATH)) {
+                printOut("+ %s%s\n", relPath, (b->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? "\\" : "");
+                ctx->added++;
+            }
+            j++;
+            continue;
+        }
+
+        const int aIsDir = (a->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        const int bIsDir = (b->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        const int differs = aIsDir != bIsDir ||
+            (!aIsDir && (entrySize(a) != entrySize(b) ||
+                         CompareFileTime(&a->ftLastWriteTime, &b->ftLastWriteTime)));
+        if (differs) {
+            /* A pair is reported if either side matches, so an entry that starts matching shows as changed */
+            if ((lkMatchPredicates(ctx->match, pathA, &listA->entries[i]) ||
+                 lkMatchPredicates(ctx->match, pathB, &listB->entries[j])) &&
+                joinPath(rel, a->cFileName, relPath, MAX_PATH)) {
+                printDiffChange(relPath, a, b);
+                ctx->changed++;
             }
+        } else if (aIsDir && descend &&
+                   !((a->dwFileAttributes | b->dwFileAttributes) & FILE_ATTRIBUTE_REPARSE_POINT) &&
+                   !lkIsPruned(&ctx->options, a->cFileName)) {
+            size_t len = strlen(a->cFileName) + 1;
+            if (used + len > capacity) {
+                capacity = capacity ? capacity * 2 : 1024;
+                while (capacity < used + len)
+                    capacity *= 2;
+                char *temp = (char *)realloc(names, capacity);
+                if (!temp) {
+                    fatalError("Memory allocation failed for subdirectory names.");
+                    break;
+                }
+                names = temp;
+            }
+            memcpy(names + used, a->cFileName, len);
+            used += len;
         }
+        i++;
+        j++;
+    }
+
+    /* Both lists are reused by the recursion, so only the common names survive this point */
+    for (size_t offset = 0; offset < used && !requestFailed(); offset += strlen(names + offset) + 1) {
+        char newPathA[MAX_PATH], newPathB[MAX_PATH], newRel[MAX_PATH];
+        if (joinPath(pathA, names + offset, newPathA, MAX_PATH) &&
+            joinPath(pathB, names + offset, newPathB, MAX_PATH) &&
+            joinPath(rel, names + offset, newRel, MAX_PATH))
+            diffDirectory(ctx, newPathA, newPathB, newRel, depth + 1);
+    }
+    free(names);
+}
+
+/* --diff entry point: report what changed going from tree pathA to tree pathB */
+static void diffTrees(const char *restrict pathA, const char *restrict pathB) {
+    DiffContext *ctx = (DiffContext *)calloc(1, sizeof(DiffContext));
+    if (!ctx) {
+        fatalError("Memory allocation failed for diff context.");
+        return;
+    }
+
+    /* Merge-joining needs a total order on names alone */
+    ctx->options = g_options.lk;
+    ctx->options.sortBySize = ctx->options.sortByTime = ctx->options.sortByExtension = 0;
+    ctx->options.reverseSort = ctx->options.groupDirs = ctx->options.naturalSort = 0;
+    /* Read everything; diffDirectory applies the predicates to the joined pairs */
+    ctx->options.predicateCount = 0;
+    ctx->match = &g_options.lk;
+
+    if (!initFileList(&ctx->list) || !initFileList(&ctx->reader.list)) {
+        lkFreeFileList(&ctx->list);
+        free(ctx);
+        return;
     }
-    freeFileList(&list);
+    ctx->reader.options = &ctx->options;
+    ctx->reader.hRequest = CreateEventA(NULL, FALSE, FALSE, NULL);
+    ctx->reader.hDone = CreateEventA(NULL, FALSE, FALSE, NULL);
+    if (ctx->reader.hRequest && ctx->reader.hDone)
+        ctx->reader.hThread = CreateThread(NULL, 0, diffReaderThread, &ctx->reader, 0, NULL);
+
+    printOut("\nComparing [%s] with [%s]:\n", pathA, pathB);
+    diffDirectory(ctx, pathA, pathB, "", 0);
+    if (g_options.lk.showSummary && !requestFailed()) {
+        printOut("\nSummary: %llu added, %llu removed, %llu changed\n",
+               ctx->added, ctx->removed, ctx->changed);
+    }
+
+    if (ctx->reader.hThread) {
+        ctx->reader.quit = 1;
+        SetEvent(ctx->reader.hRequest);
+        WaitForSingleObject(ctx->reader.hThread, INFINITE);
+        CloseHandle(ctx->reader.hThread);
+    }
+    if (ctx->reader.hRequest)
+        CloseHandle(ctx->reader.hRequest);
+    if (ctx->reader.hDone)
+        CloseHandle(ctx->reader.hDone);
+    lkFreeFileList(&ctx->reader.list);
+    lkFreeFileList(&ctx->list);
+    free(ctx);
 }
 
-/* Retrieve file owner as "DOMAIN\\Name"; returns 1 on success */
+/* Retrieve file owner as "DOMAIN\\Name" through liblk, reporting failures; returns 1 on success */
 int getFileOwner(const char *filePath, char *owner, DWORD ownerSize) {
-    char stackBuffer[1024];
-    DWORD dwSize = sizeof(stackBuffer);
-    PSECURITY_DESCRIPTOR psd = (PSECURITY_DESCRIPTOR)stackBuffer;
-    int allocated = 0;
-    if (!GetFileSecurityA(filePath, OWNER_SECURITY_INFORMATION, psd, dwSize, &dwSize)) {
-         if (GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
-              fprintf(stderr, "Error: Unable to retrieve security info for '%s' (Error code: %lu)\n", filePath, GetLastError());
-              return 0;
-         }
-         psd = (PSECURITY_DESCRIPTOR)malloc(dwSize);
-         if (!psd) {
-              fprintf(stderr, "Error: Memory allocation failed for security descriptor for '%s'.\n", filePath);
-              return 0;
-         }
-         allocated = 1;
-         if (!GetFileSecurityA(filePath, OWNER_SECURITY_INFORMATION, psd, dwSize, &dwSize)) {
-              fprintf(stderr, "Error: Failed to get security descriptor for '%s' (Error code: %lu)\n", filePath, GetLastError());
-              free(psd);
-              return 0;
-         }
-    }
-    PSID pSid = NULL;
-    BOOL ownerDefaulted = FALSE;
-    if (!GetSecurityDescriptorOwner(psd, &pSid, &ownerDefaulted)) {
-         fprintf(stderr, "Error: Failed to retrieve owner from security descriptor for '%s'.\n", filePath);
-         if (allocated) free(psd);
-         return 0;
-    }
-    char name[256] = {0}, domain[256] = {0};
-    DWORD nameSize = sizeof(name), domainSize = sizeof(domain);
-    SID_NAME_USE sidType;
-    if (!LookupAccountSidA(NULL, pSid, name, &nameSize, domain, &domainSize, &sidType)) {
-         fprintf(stderr, "Error: LookupAccountSid failed for '%s' (Error code: %lu)\n", filePath, GetLastError());
-         if (allocated) free(psd);
-         return 0;
-    }
-    snprintf(owner, ownerSize, "%s\\%s", domain, name);
-    if (allocated) free(psd);
+    if (lkGetFileOwner(filePath, owner, ownerSize))
+        return 1;
+    printErr("Error: Unable to retrieve owner for '%s' (Error code: %lu)\n", filePath, GetLastError());
+    return 0;
+}
+
+/* Usage text for -h/--help and option errors */
+static const char g_helpText[] =
+    "\nUsage: lk [options] [path ...]\n"
+    "       lk --serve\n"
+    "       lk --client [options] [path ...]\n\n"
+    "Options:\n"
+    "  -a, --all         Show hidden files\n"
+    "  -s, --short       Use short format (disable long listing)\n"
+    "  -R                Recursively list subdirectories\n"
+    "  -L, --follow      Follow directory links and junctions during recursion\n"
+    "  -S                Sort by file size\n"
+    "  -t                Sort by modification time\n"
+    "  -x                Sort by file extension\n"
+    "  -r                Reverse sort order\n"
+    "  -b, --bytes       Show file sizes in raw bytes (default: human-readable)\n"
+    "  -F                Append file type indicator (default: on)\n"
+    "  -d                List directory entry itself, not its contents\n"
+    "  -n, --no-group    Do not group directories first (default: grouped)\n"
+    "  -E                Show file creation time\n"
+    "  -T                Tree view of directory structure\n"
+    "  -N                Disable natural sorting\n"
+    "  -P                Show full file path\n"
+    "  -O                Display file owner\n"
+    "  -M                Show summary (default: on)\n"
+    "  -h, --help        Display this help message\n"
+    "  -v, --version     Display version information\n"
+    "  --analyze         Report size, age and extension statistics for the whole tree\n"
+    "  --diff A B        Show entries added, removed or changed from tree A to tree B\n"
+    "  --estimate SECS   Estimate directories, files and size of the tree by sampling for SECS seconds\n"
+    "  --merge           List all paths as one sorted listing (e.g. -t across volumes)\n"
+    "  --git             Show git status: M modified, ? untracked, ! ignored\n"
+    "  --git-dirs        Like --git, and mark directories holding modified files (stats every tracked file)\n"
+    "  --inode-order     Read metadata and subdirectories in on-disk order (cold disks)\n"
+    "  --max-depth N     Descend at most N levels below each path with -R/-T\n"
+    "  --prune GLOB      Do not descend into directories named GLOB (repeatable)\n"
+    "  --name GLOB       Only show entries whose name matches GLOB\n"
+    "  --type f|d|l      Only show files, directories and/or links (letters combine)\n"
+    "  --attr FLAGS      Only show entries with attributes RHSACEOT set (clear after '-')\n"
+    "  --size [+|-]N     Only show files larger (+), smaller (-) or exactly N[K|M|G|T] bytes\n"
+    "  --newer WHEN      Only show entries modified after WHEN (YYYY-MM-DD, age like 7d, or a file)\n"
+    "  --older WHEN      Only show entries modified before WHEN\n"
+    "  --owner GLOB      Only show entries whose owner matches GLOB (checked last)\n"
+    "  --throttle N      Read at most N entries per second (0 = no cap) at background priority\n"
+    "  --concurrency N   Enumerate at most N directories at once\n"
+    "  --serve           Run as a resident server that caches directory listings\n"
+    "  --client          Forward the remaining arguments to a running lk --serve\n\n"
+    "Examples:\n"
+    "  lk -s\n"
+    "  lk -b\n"
+    "  lk -n\n"
+    "  lk -R C:\\path\\to\\directory\n"
+    "  lk -R --max-depth 2 --prune .git --prune node_modules\n"
+    "  lk -T D:\\releases\\build.zip\n"
+    "  lk -R --type f --size +1G --older 90d D:\\shares\n\n";
+
+/* parseArguments result meaning "arguments accepted, list the collected paths" */
+#define PARSE_CONTINUE (-1)
+
+/* Parse "[+|-]N[K|M|G|T|P][B]" for --size */
+static int parseSizePredicate(const char *restrict text, LkPredicate *predicate) {
+    predicate->compare = (*text == '+') ? 1 : (*text == '-') ? -1 : 0;
+    if (predicate->compare)
+        text++;
+    if (*text < '0' || *text > '9')
+        return 0;
+    char *endPtr;
+    ULONGLONG value = strtoull(text, &endPtr, 10);
+    int shift = 0;
+    switch (*endPtr | 0x20) {
+        case 'k': shift = 10; endPtr++; break;
+        case 'm': shift = 20; endPtr++; break;
+        case 'g': shift = 30; endPtr++; break;
+        case 't': shift = 40; endPtr++; break;
+        case 'p': shift = 50; endPtr++; break;
+    }
+    if ((*endPtr | 0x20) == 'b')
+        endPtr++;
+    if (*endPtr || value > (ULLONG_MAX >> shift))
+        return 0;
+    predicate->value = value << shift;
     return 1;
 }
 
-/* Main entry point for the directory listing utility */
-int main(int argc, char *argv[]) {
-    const char *helpText =
-        "\nUsage: lk [options] [path ...]\n\n"
-        "Options:\n"
-        "  -a, --all         Show hidden files\n"
-        "  -s, --short       Use short format (disable long listing)\n"
-        "  -R                Recursively list subdirectories\n"
-        "  -S                Sort by file size\n"
-        "  -t                Sort by modification time\n"
-        "  -x                Sort by file extension\n"
-        "  -r                Reverse sort order\n"
-        "  -b, --bytes       Show file sizes in raw bytes (default: human-readable)\n"
-        "  -F                Append file type indicator (default: on)\n"
-        "  -d                List directory entry itself, not its contents\n"
-        "  -n, --no-group    Do not group directories first (default: grouped)\n"
-        "  -E                Show file creation time\n"
-        "  -T                Tree view of directory structure\n"
-        "  -N                Disable natural sorting\n"
-        "  -P                Show full file path\n"
-        "  -O                Display file owner\n"
-        "  -M                Show summary (default: on)\n"
-        "  -h, --help        Display this help message\n"
-        "  -v, --version     Display version information\n\n"
-        "Examples:\n"
-        "  lk -s\n"
-        "  lk -b\n"
-        "  lk -n\n"
-        "  lk -R C:\\path\\to\\directory\n\n";
-
-    int fileCount = 0, filesCapacity = 16;
+/*
+ * Parse WHEN for --newer/--older into FILETIME ticks: an age such as "30m", "12h", "7d"
+ * or "2w" before now, a local date "YYYY-MM-DD[ HH:MM[:SS]]", or the path of a file
+ * whose last write time is used.
+ */
+static int parseTimeValue(const char *restrict text, ULONGLONG *ticks) {
+    char *endPtr;
+    if (*text >= '0' && *text <= '9') {
+        ULONGLONG amount = strtoull(text, &endPtr, 10);
+        ULONGLONG unit = 0;
+        switch (*endPtr) {
+            case 's': unit = 10000000ULL; break;
+            case 'm': unit = 60 * 10000000ULL; break;
+            case 'h': unit = 3600 * 10000000ULL; break;
+            case 'd': unit = 86400 * 10000000ULL; break;
+            case 'w': unit = 7 * 86400 * 10000000ULL; break;
+        }
+        if (unit && !endPtr[1]) {
+            FILETIME now;
+            GetSystemTimeAsFileTime(&now);
+            ULONGLONG nowTicks = (((ULONGLONG)now.dwHighDateTime) << 32) | now.dwLowDateTime;
+            ULONGLONG delta = amount > nowTicks / unit ? nowTicks : amount * unit;
+            *ticks = nowTicks - delta;
+            return 1;
+        }
+
+        SYSTEMTIME local = {0}, utc;
+        int year, month, day, hour = 0, minute = 0, second = 0, consumed = 0;
+        if (sscanf(text, "%4d-%2d-%2d%n", &year, &month, &day, &consumed) == 3) {
+            const char *rest = text + consumed;
+            if (*rest == ' ' || *rest == 'T') {
+                int more = 0;
+                if (sscanf(rest + 1, "%2d:%2d%n", &hour, &minute, &more) != 2)
+                    return 0;
+                rest += 1 + more;
+                if (*rest == ':') {
+                    if (sscanf(rest + 1, "%2d%n", &second, &more) != 1)
+                        return 0;
+                    rest += 1 + more;
+                }
+            }
+            if (*rest)
+                return 0;
+            local.wYear = (WORD)year; local.wMonth = (WORD)month; local.wDay = (WORD)day;
+            local.wHour = (WORD)hour; local.wMinute = (WORD)minute; local.wSecond = (WORD)second;
+            FILETIME ft;
+            if (!TzSpecificLocalTimeToSystemTime(NULL, &local, &utc) || !SystemTimeToFileTime(&utc, &ft))
+                return 0;
+            *ticks = (((ULONGLONG)ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+            return 1;
+        }
+    }
+
+    /* Reference file, relative to the client's directory under --serve */
+    char path[MAX_PATH];
+    WIN32_FIND_DATAA data;
+    if (!fullPath(text, path, MAX_PATH))
+        return 0;
+    HANDLE hFind = FindFirstFileA(path, &data);
+    if (hFind == INVALID_HANDLE_VALUE)
+        return 0;
+    FindClose(hFind);
+    *ticks = (((ULONGLONG)data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+    return 1;
+}
+
+/* Parse attribute letters for --attr; letters after '-' must be clear, after '+' set */
+static int parseAttrPredicate(const char *restrict text, LkPredicate *predicate) {
+    static const char letters[] = "RHSACEOT";
+    static const DWORD masks[] = {
+        FILE_ATTRIBUTE_READONLY, FILE_ATTRIBUTE_HIDDEN, FILE_ATTRIBUTE_SYSTEM,
+        FILE_ATTRIBUTE_ARCHIVE, FILE_ATTRIBUTE_COMPRESSED, FILE_ATTRIBUTE_ENCRYPTED,
+        FILE_ATTRIBUTE_OFFLINE, FILE_ATTRIBUTE_TEMPORARY
+    };
+    int clear = 0;
+    for (; *text; text++) {
+        if (*text == '-' || *text == '+') {
+            clear = (*text == '-');
+            continue;
+        }
+        /* Letters only: strchr also matches the terminator, which a space used to reach */
+        if (!isalpha((unsigned char)*text))
+            return 0;
+        const char *letter = strchr(letters, toupper((unsigned char)*text));
+        if (!letter)
+            return 0;
+        if (clear)
+            predicate->clearMask |= masks[letter - letters];
+        else
+            predicate->setMask |= masks[letter - letters];
+    }
+    return predicate->setMask || predicate->clearMask;
+}
+
+/*
+ * Turn a predicate option and its value into an LkPredicate on g_options.
+ * Returns -1 if option is not a predicate option, 0 if value is invalid, 1 on success.
+ */
+static int addPredicateOption(const char *restrict option, const char *restrict value) {
+    LkPredicate predicate;
+    memset(&predicate, 0, sizeof(predicate));
+    int ok = 1;
+    if (!strcmp(option, "--name") || !strcmp(option, "--owner")) {
+        predicate.kind = (option[2] == 'n') ? LK_PRED_NAME : LK_PRED_OWNER;
+        ok = strlen(value) < sizeof(predicate.pattern);
+        if (ok)
+            strcpy(predicate.pattern, value);
+    } else if (!strcmp(option, "--type")) {
+        predicate.kind = LK_PRED_TYPE;
+        for (const char *p = value; *p && ok; p++) {
+            switch (*p) {
+                case 'f': predicate.setMask |= LK_TYPE_FILE; break;
+                case 'd': predicate.setMask |= LK_TYPE_DIR; break;
+                case 'l': predicate.setMask |= LK_TYPE_LINK; break;
+                default:  ok = 0; break;
+            }
+        }
+        ok = ok && predicate.setMask;
+    } else if (!strcmp(option, "--attr")) {
+        predicate.kind = LK_PRED_ATTR;
+        ok = parseAttrPredicate(value, &predicate);
+    } else if (!strcmp(option, "--size")) {
+        predicate.kind = LK_PRED_SIZE;
+        ok = parseSizePredicate(value, &predicate);
+    } else if (!strcmp(option, "--newer") || !strcmp(option, "--older")) {
+        predicate.kind = (option[2] == 'n') ? LK_PRED_NEWER : LK_PRED_OLDER;
+        ok = parseTimeValue(value, &predicate.value);
+    } else {
+        return -1;
+    }
+    return ok && lkAddPredicate(&g_options.lk, &predicate);
+}
+
+/*
+ * Parse command-line arguments into g_options and collect the path arguments.
+ * Returns PARSE_CONTINUE and hands back a malloc'ed array of argv pointers in *filesOut
+ * (defaulting to "."), or an exit status once the arguments have been fully handled
+ * (help, version or an invalid option).
+ */
+static int parseArguments(int argc, char *argv[], char ***filesOut, int *fileCountOut) {
+    int fileCount = 0, filesCapacity = 16, status;
     char **files = (char **)malloc(filesCapacity * sizeof(*files));
-    if (!files)
+    if (!files) {
         fatalError("Memory allocation failed for files array.");
+        return EXIT_FAILURE;
+    }
 
     /* Parse command-line arguments to set options and collect paths */
     for (int i = 1; i < argc; i++) {
         if (argv[i][0] == '-') {
             if (argv[i][1] == '-') {
                 if (!strcmp(argv[i], "--all"))
-                    g_options.showAll = 1;
+                    g_options.lk.showAll = 1;
                 else if (!strcmp(argv[i], "--short"))
-                    g_options.longFormat = 0;
+                    g_options.lk.longFormat = 0;
                 else if (!strcmp(argv[i], "--bytes"))
-                    g_options.humanSize = 0;
+                    g_options.lk.humanSize = 0;
                 else if (!strcmp(argv[i], "--no-group"))
-                    g_options.groupDirs = 0;
+                    g_options.lk.groupDirs = 0;
+                else if (!strcmp(argv[i], "--analyze"))
+                    g_options.analyze = g_options.lk.recursive = 1;
+                else if (!strcmp(argv[i], "--diff"))
+                    g_options.diff = 1;
+                else if (!strcmp(argv[i], "--git"))
+                    g_options.gitStatus = 1;
+                else if (!strcmp(argv[i], "--git-dirs"))
+                    g_options.gitStatus = g_options.gitDirs = 1;
+                else if (!strcmp(argv[i], "--merge"))
+                    g_options.merge = 1;
+                else if (!strcmp(argv[i], "--follow"))
+                    g_options.followLinks = 1;
+                else if (!strcmp(argv[i], "--inode-order"))
+                    g_options.lk.inodeOrder = 1;
+                else if (!strcmp(argv[i], "--max-depth") && i + 1 < argc) {
+                    char *endPtr;
+                    long depth = strtol(argv[++i], &endPtr, 10);
+                    if (*endPtr || depth < 0 || depth > INT_MAX) {
+                        printErr("Invalid depth for --max-depth: %s\n", argv[i]);
+                        free(files);
+                        return EXIT_FAILURE;
+                    }
+                    g_options.lk.maxDepth = (int)depth;
+                } else if ((!strcmp(argv[i], "--throttle") || !strcmp(argv[i], "--concurrency")) && i + 1 < argc) {
+                    const int isRate = argv[i][2] == 't';
+                    char *endPtr;
+                    long value = strtol(argv[++i], &endPtr, 10);
+                    if (*endPtr || value < (isRate ? 0 : 1) || value > INT_MAX) {
+                        printErr("Invalid value for %s: %s\n", argv[i - 1], argv[i]);
+                        free(files);
+                        return EXIT_FAILURE;
+                    }
+                    if (isRate)
+                        g_options.throttleRate = (int)value;
+                    else
+                        g_options.maxConcurrency = (int)value;
+                } else if (!strcmp(argv[i], "--estimate") && i + 1 < argc) {
+                    char *endPtr;
+                    long seconds = strtol(argv[++i], &endPtr, 10);
+                    if (*endPtr || seconds < 1 || seconds > 86400) {
+                        printErr("Invalid time limit for --estimate: %s\n", argv[i]);
+                        free(files);
+                        return EXIT_FAILURE;
+                    }
+                    g_options.estimateSeconds = (int)seconds;
+                    g_options.lk.recursive = 1;
+                } else if (i + 1 < argc && (status = addPredicateOption(argv[i], argv[i + 1])) >= 0) {
+                    if (!status) {
+                        printErr("Invalid value for %s: %s\n", argv[i], argv[i + 1]);
+                        free(files);
+                        return EXIT_FAILURE;
+                    }
+                    i++;
+                } else if (!strcmp(argv[i], "--prune") && i + 1 < argc) {
+                    if (g_options.lk.pruneCount >= LK_MAX_PRUNE_PATTERNS) {
+                        printErr("Too many --prune patterns (maximum %d).\n", LK_MAX_PRUNE_PATTERNS);
+                        free(files);
+                        return EXIT_FAILURE;
+                    }
+                    g_options.lk.prunePatterns[g_options.lk.pruneCount++] = argv[++i];
+                }
                 else if (!strcmp(argv[i], "--help")) {
-                    printf("%s", helpText);
+                    printOut("%s", g_helpText);
                     free(files);
                     return EXIT_SUCCESS;
                 } else if (!strcmp(argv[i], "--version")) {
-                    printf("lk version 1.5\n");
+                    printOut("lk version " LK_VERSION "\n");
                     free(files);
                     return EXIT_SUCCESS;
                 } else {
-                    fprintf(stderr, "Unknown option: %s\n", argv[i]);
-                    printf("%s", helpText);
+                    printErr("Unknown option: %s\n", argv[i]);
+                    printOut("%s", g_helpText);
                     free(files);
                     return EXIT_FAILURE;
                 }
@@ -865,34 +2439,35 @@ int main(int argc, char *argv[]) {
                 size_t len = strlen(argv[i]);
                 for (size_t j = 1; j < len; j++) {
                     switch (argv[i][j]) {
-                        case 'a': g_options.showAll = 1; break;
-                        case 's': g_options.longFormat = 0; break;
-                        case 'R': g_options.recursive = 1; break;
-                        case 'S': g_options.sortBySize = 1; break;
-                        case 't': g_options.sortByTime = 1; break;
-                        case 'x': g_options.sortByExtension = 1; break;
-                        case 'r': g_options.reverseSort = 1; break;
-                        case 'b': g_options.humanSize = 0; break;
-                        case 'F': g_options.fileTypeIndicator = 1; break;
-                        case 'd': g_options.listDirs = 1; break;
-                        case 'n': g_options.groupDirs = 0; break;
-                        case 'E': g_options.showCreationTime = 1; break;
-                        case 'T': g_options.treeView = 1; break;
-                        case 'N': g_options.naturalSort = 0; break;
-                        case 'P': g_options.showFullPath = 1; break;
-                        case 'O': g_options.showOwner = 1; break;
-                        case 'M': g_options.showSummary = 1; break;
+                        case 'a': g_options.lk.showAll = 1; break;
+                        case 's': g_options.lk.longFormat = 0; break;
+                        case 'R': g_options.lk.recursive = 1; break;
+                        case 'L': g_options.followLinks = 1; break;
+                        case 'S': g_options.lk.sortBySize = 1; break;
+                        case 't': g_options.lk.sortByTime = 1; break;
+                        case 'x': g_options.lk.sortByExtension = 1; break;
+                        case 'r': g_options.lk.reverseSort = 1; break;
+                        case 'b': g_options.lk.humanSize = 0; break;
+                        case 'F': g_options.lk.fileTypeIndicator = 1; break;
+                        case 'd': g_options.lk.listDirs = 1; break;
+                        case 'n': g_options.lk.groupDirs = 0; break;
+                        case 'E': g_options.lk.showCreationTime = 1; break;
+                        case 'T': g_options.lk.treeView = 1; break;
+                        case 'N': g_options.lk.naturalSort = 0; break;
+                        case 'P': g_options.lk.showFullPath = 1; break;
+                        case 'O': g_options.lk.showOwner = 1; break;
+                        case 'M': g_options.lk.showSummary = 1; break;
                         case 'h':
-                            printf("%s", helpText);
+                            printOut("%s", g_helpText);
                             free(files);
                             return EXIT_SUCCESS;
                         case 'v':
-                            printf("lk version 1.5\n");
+                            printOut("lk version " LK_VERSION "\n");
                             free(files);
                             return EXIT_SUCCESS;
                         default:
-                            fprintf(stderr, "Unknown option: -%c\n", argv[i][j]);
-                            printf("%s", helpText);
+                            printErr("Unknown option: -%c\n", argv[i][j]);
+                            printOut("%s", g_helpText);
                             free(files);
                             return EXIT_FAILURE;
                     }
@@ -902,14 +2477,14 @@ int main(int argc, char *argv[]) {
             if (fileCount >= filesCapacity) {
                 /* Check for potential overflow before doubling capacity */
                 if (filesCapacity > SIZE_MAX / 2) {
-                    fprintf(stderr, "Error: Maximum file capacity reached.\n");
+                    printErr("Error: Maximum file capacity reached.\n");
                     free(files);
                     return EXIT_FAILURE;
                 }
                 filesCapacity *= 2;
                 char **temp = (char **)realloc(files, filesCapacity * sizeof(*files));
                 if (!temp) {
-                    fprintf(stderr, "Error: Memory reallocation failed.\n");
+                    printErr("Error: Memory reallocation failed.\n");
                     free(files);
                     return EXIT_FAILURE;
                 }
@@ -919,57 +2494,576 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    if (g_options.diff && fileCount != 2) {
+        printErr("--diff needs exactly two paths to compare.\n");
+        free(files);
+        return EXIT_FAILURE;
+    }
+
     /* Default to current directory if no paths specified */
     if (fileCount == 0) {
         files[0] = ".";
         fileCount = 1;
     }
 
+    *filesOut = files;
+    *fileCountOut = fileCount;
+    return PARSE_CONTINUE;
+}
+
+/*
+ * --merge: one listing over several roots.
+ * Each root is read and sorted on its own (on worker threads, since the reads are
+ * I/O bound), then a binary heap holding the current head of every root yields the
+ * rows in global order. No combined list is built; each row ends with its full path
+ * so the root it came from stays visible.
+ */
+#define MERGE_MAX_THREADS 16
+
+typedef struct {
+    const char *path;
+    char directory[MAX_PATH];  // path without a trailing wildcard component, for full paths
+    FileList list;
+    DWORD error;       // 0, or why the root could not be read
+    size_t next;       // Head position during the merge
+} MergeRoot;
+
+typedef struct {
+    const LkOptions *options;
+    MergeRoot *roots;
+    LONG count;
+    volatile LONG next;
+} MergeQueue;
+
+static DWORD WINAPI mergeReadThread(LPVOID param) {
+    MergeQueue *queue = (MergeQueue *)param;
+    LONG index;
+    while ((index = InterlockedIncrement(&queue->next) - 1) < queue->count) {
+        MergeRoot *root = &queue->roots[index];
+        if (!lkReadDirectory(queue->options, root->path, &root->list))
+            root->error = GetLastError();
+        else
+            lkSortFileList(queue->options, &root->list);
+    }
+    return 0;
+}
+
+/* Heap order: the lesser head entry first, ties broken by root order so equal rows keep their roots' order */
+static int mergeLess(const MergeRoot *roots, size_t a, size_t b) {
+    int cmp = lkCompareEntries(&g_options.lk, &roots[a].list.entries[roots[a].next], &roots[b].list.entries[roots[b].next]);
+    return cmp ? cmp < 0 : a < b;
+}
+
+static void mergeSiftDown(const MergeRoot *roots, size_t *heap, size_t count, size_t i) {
+    for (;;) {
+        size_t least = i, left = 2 * i + 1, right = left + 1;
+        if (left < count && mergeLess(roots, heap[left], heap[least]))
+            least = left;
+        if (right < count && mergeLess(roots, heap[right], heap[least]))
+            least = right;
+        if (least == i)
+            return;
+        size_t swap = heap[i];
+        heap[i] = heap[least];
+        heap[least] = swap;
+        i = least;
+    }
+}
+
+static void mergeListing(char *absPaths, int rootCount, HANDLE hConsole, WORD defaultAttr) {
+    MergeRoot *roots = (MergeRoot *)calloc((size_t)rootCount, sizeof(MergeRoot));
+    size_t *heap = (size_t *)malloc((size_t)rootCount * sizeof(size_t));
+    if (!roots || !heap) {
+        fatalError("Memory allocation failed for merged listing.");
+        free(roots);
+        free(heap);
+        return;
+    }
+    int ready = 1;
+    for (int i = 0; i < rootCount && ready; i++) {
+        roots[i].path = absPaths + (size_t)i * MAX_PATH;
+        strcpy(roots[i].directory, roots[i].path);
+        char *sep = strrchr(roots[i].directory, '\\');
+        if (sep && strpbrk(sep, "*?"))
+            *sep = '\0';
+        ready = initFileList(&roots[i].list);
+    }
+    if (!ready) {
+        for (int i = 0; i < rootCount; i++)
+            lkFreeFileList(&roots[i].list);
+        free(roots);
+        free(heap);
+        return;
+    }
+
+    /* Only the entries of the roots themselves are merged */
+    LkOptions options = g_options.lk;
+    options.recursive = 0;
+    MergeQueue queue = { &options, roots, rootCount, 0 };
+    HANDLE threads[MERGE_MAX_THREADS];
+    size_t started = 0;
+    while (started < MERGE_MAX_THREADS && started + 1 < (size_t)rootCount) {
+        threads[started] = CreateThread(NULL, 0, mergeReadThread, &queue, 0, NULL);
+        if (!threads[started])
+            break;
+        started++;
+    }
+    mergeReadThread(&queue);
+    for (size_t i = 0; i < started; i++) {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+
+    printOut("\n[");
+    size_t heapCount = 0;
+    for (int i = 0; i < rootCount; i++) {
+        printOut(i ? " + %s" : "%s", roots[i].path);
+        if (roots[i].error)
+            printErr("Error: Unable to open directory '%s' (Error code: %lu)\n", roots[i].path, roots[i].error);
+        else if (roots[i].list.count)
+            heap[heapCount++] = (size_t)i;
+    }
+    printOut("]:\n");
+    buildRowPlan(1);
+    printColumnHeader();
+
+    for (size_t i = heapCount / 2; i-- > 0;)
+        mergeSiftDown(roots, heap, heapCount, i);
+
+    int dirCount = 0, fileCount = 0, shown = 0;
+    ULONGLONG totalSize = 0;
+    while (heapCount && !requestFailed()) {
+        MergeRoot *root = &roots[heap[0]];
+        const FileEntry *entry = &root->list.entries[root->next];
+        printFileEntry(root->directory, ++shown, entry, NULL, hConsole, defaultAttr);
+        if (entry->findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            ++dirCount;
+        } else {
+            ++fileCount;
+            totalSize += ((ULONGLONG)entry->findData.nFileSizeHigh << 32) | entry->findData.nFileSizeLow;
+        }
+        /* Advance the root that supplied the row, or drop it when exhausted */
+        if (++root->next == root->list.count)
+            heap[0] = heap[--heapCount];
+        mergeSiftDown(roots, heap, heapCount, 0);
+    }
+
+    if (g_options.lk.showSummary && !requestFailed()) {
+        char sizeStr[32] = {0};
+        lkFormatSize(totalSize, sizeStr, sizeof(sizeStr), g_options.lk.humanSize);
+        printOut("\nSummary: %d directories, %d files, total size: %s\n",
+               dirCount, fileCount, sizeStr);
+    }
+
+    for (int i = 0; i < rootCount; i++)
+        lkFreeFileList(&roots[i].list);
+    free(roots);
+    free(heap);
+}
+
+/* Resolve each path to an absolute path and list it according to g_options */
+static void listResolvedPaths(char **files, int fileCount, HANDLE hConsole, WORD defaultAttr) {
+    buildRowPlan(g_options.lk.showFullPath);
+
     /* Allocate block for absolute paths to improve memory locality */
     char *absPathsBlock = (char *)malloc(fileCount * MAX_PATH);
     if (!absPathsBlock) {
-        free(files);
         fatalError("Memory allocation failed for absolute paths block.");
+        return;
     }
 
-    /* Convert all paths to absolute paths */
+    /* Convert all paths to absolute paths; relative ones are relative to the client under --serve */
     for (int i = 0; i < fileCount; i++) {
         char *absPath = absPathsBlock + i * MAX_PATH;
-        if (!GetFullPathNameA(files[i], MAX_PATH, absPath, NULL)) {
+        if (!fullPath(files[i], absPath, MAX_PATH)) {
             strncpy(absPath, files[i], MAX_PATH - 1);
             absPath[MAX_PATH - 1] = '\0';
         }
     }
-    free(files);
 
-    /* Initialize console handle and default attributes */
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    CONSOLE_SCREEN_BUFFER_INFO csbi;
-    WORD defaultAttr;
-    if (!GetConsoleScreenBufferInfo(hConsole, &csbi)) {
-        defaultAttr = GRAY_TEXT; /* Fallback to gray if console info unavailable */
-        fprintf(stderr, "Warning: Failed to get console buffer info (Error code: %lu)\n", GetLastError());
-    } else {
-        defaultAttr = csbi.wAttributes;
+    if (g_options.diff) {
+        diffTrees(absPathsBlock, absPathsBlock + MAX_PATH);
+        fileCount = 0;
+    } else if (g_options.merge) {
+        mergeListing(absPathsBlock, fileCount, hConsole, defaultAttr);
+        fileCount = 0;
     }
 
     /* Process each path according to options */
-    for (int i = 0; i < fileCount; i++) {
+    for (int i = 0; i < fileCount && !requestFailed(); i++) {
         char *currentPath = absPathsBlock + i * MAX_PATH;
         if (fileCount > 1)
-            printf("==> %s <==\n", currentPath);
-
-        if (g_options.listDirs)
+            printOut("==> %s <==\n", currentPath);
+
+        /* With -L the roots are recorded too, so links back to them are caught */
+        VisitKey rootKey;
+        VisitState rootState = VISIT_UNKNOWN;
+        if (g_options.followLinks && !g_options.analyze && !g_options.estimateSeconds && !g_options.lk.listDirs &&
+            !enterDirectory(currentPath, &rootKey, &rootState))
+            rootState = VISIT_UNKNOWN;   /* Given twice: list it again */
+
+        if (g_options.estimateSeconds)
+            estimateDirectory(currentPath);
+        else if (g_options.analyze)
+            analyzeDirectory(currentPath);
+        else if (g_options.lk.listDirs)
             listDirectorySelf(currentPath, hConsole, defaultAttr);
-        else if (g_options.treeView)
+        else if (g_options.lk.treeView)
             treeDirectory(currentPath, hConsole, defaultAttr, 0);
         else
-            listDirectory(currentPath, hConsole, defaultAttr);
+            listDirectory(currentPath, hConsole, defaultAttr, 0);
+        leaveDirectory(&rootKey, rootState);
 
         if (i < fileCount - 1)
-            printf("\n");
+            printOut("\n");
     }
 
+    gitReset();
+    resetVisited();
     free(absPathsBlock);
+}
+
+/*
+ * listPaths: listResolvedPaths with a per-listing archive cache, under --throttle / --concurrency.
+ * Every enumeration, on any thread, draws from one shared token bucket and concurrency
+ * limit, and --throttle also moves the process into background mode, which lowers its
+ * CPU, I/O and memory priority, for the duration of the listing. Background mode
+ * belongs to the whole process, so under --serve it lasts while any request wants it.
+ */
+static THREAD_LOCAL LkThrottle g_throttle;
+static THREAD_LOCAL int g_background = 0;   // This listing holds a background mode reference
+static SRWLOCK g_backgroundLock = SRWLOCK_INIT;
+static int g_backgroundUsers = 0;           // Listings in background mode, across server requests
+
+/* Enter (1) or leave (0) background mode on behalf of one listing */
+static int setBackground(int enter) {
+    int ok = 1;
+    AcquireSRWLockExclusive(&g_backgroundLock);
+    if (enter && g_backgroundUsers++ == 0)
+        ok = SetPriorityClass(GetCurrentProcess(), PROCESS_MODE_BACKGROUND_BEGIN);
+    else if (!enter && --g_backgroundUsers == 0)
+        SetPriorityClass(GetCurrentProcess(), PROCESS_MODE_BACKGROUND_END);
+    if (!ok)
+        g_backgroundUsers = 0;
+    ReleaseSRWLockExclusive(&g_backgroundLock);
+    return ok;
+}
+
+/* Leave the --throttle / --concurrency state */
+static void endThrottle(void) {
+    if (g_background)
+        setBackground(0);
+    g_background = 0;
+    if (g_options.lk.throttle)
+        lkThrottleFree(&g_throttle);
+    g_options.lk.throttle = NULL;
+}
+
+static void listPaths(char **files, int fileCount, HANDLE hConsole, WORD defaultAttr) {
+    /* Each archive is parsed once per listing, however many of its folders are listed */
+    LkArchiveCache archives;
+    lkArchiveCacheInit(&archives);
+    g_options.lk.archiveCache = &archives;
+    if (g_options.throttleRate >= 0 || g_options.maxConcurrency > 0) {
+        if (!lkThrottleInit(&g_throttle, g_options.throttleRate, g_options.maxConcurrency)) {
+            fatalError("Unable to set up throttling.");
+            g_options.lk.archiveCache = NULL;
+            lkArchiveCacheFree(&archives);
+            return;
+        }
+        g_options.lk.throttle = &g_throttle;
+        g_background = g_options.throttleRate >= 0 && setBackground(1);
+    }
+    listResolvedPaths(files, fileCount, hConsole, defaultAttr);
+    endThrottle();
+    g_options.lk.archiveCache = NULL;
+    lkArchiveCacheFree(&archives);
+}
+
+/* Per-user pipe name, so one user's server never answers another user's client */
+static void getPipeName(char *restrict name, size_t size) {
+    char user[256];
+    DWORD userSize = sizeof(user);
+    if (!GetUserNameA(user, &userSize))
+        strcpy(user, "default");
+    snprintf(name, size, LK_PIPE_PREFIX "%s", user);
+}
+
+static HANDLE createServerPipe(const char *restrict name, int firstInstance) {
+    return CreateNamedPipeA(name,
+        PIPE_ACCESS_DUPLEX | (firstInstance ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+        PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+        PIPE_UNLIMITED_INSTANCES, LK_PIPE_BUFFER, LK_PIPE_BUFFER, 0, NULL);
+}
+
+/* Read exactly size bytes from a pipe; returns 1 on success */
+static int readPipeExact(HANDLE hPipe, void *buffer, DWORD size) {
+    char *p = (char *)buffer;
+    while (size) {
+        DWORD got = 0;
+        if (!ReadFile(hPipe, p, size, &got, NULL) || got == 0)
+            return 0;
+        p += got;
+        size -= got;
+    }
+    return 1;
+}
+
+/*
+ * Serve one connected client. The request is a DWORD length followed by
+ * "<cwd>\0<arg>\0<arg>\0...". It is run as an ordinary lk invocation from the
+ * client's working directory, and what it prints goes back in frames, ending with
+ * the exit status lk would have returned. Each client is served on its own thread
+ * with its own per-listing state; a fatal error marks only that request as failed,
+ * and the listing unwinds and frees what it allocated before the status is sent.
+ */
+static void serveClient(HANDLE hPipe) {
+    DWORD size = 0;
+    char *request = NULL;
+    char **argv = NULL;
+    Request *reply = NULL;
+    if (!readPipeExact(hPipe, &size, sizeof(size)) || size == 0 || size > LK_MAX_REQUEST ||
+        !(request = (char *)malloc(size + 1)) || !readPipeExact(hPipe, request, size)) {
+        free(request);
+        DisconnectNamedPipe(hPipe);
+        CloseHandle(hPipe);
+        return;
+    }
+    request[size] = '\0';
+
+    /* Split the request into the working directory and an argv with a placeholder argv[0] */
+    int argc = 1;
+    for (DWORD i = 0; i < size; i++) {
+        if (request[i] == '\0')
+            argc++;
+    }
+    argv = (char **)malloc((argc + 1) * sizeof(*argv));
+    reply = (Request *)malloc(sizeof(Request));
+    const char *cwd = request;
+    if (!argv || !reply || strlen(cwd) >= MAX_PATH) {
+        free(reply);
+        free(argv);
+        free(request);
+        DisconnectNamedPipe(hPipe);
+        CloseHandle(hPipe);
+        return;
+    }
+    char *p = request + strlen(request) + 1;
+    char *end = request + size;
+    argc = 0;
+    argv[argc++] = "lk";
+    while (p < end) {
+        argv[argc++] = p;
+        p += strlen(p) + 1;
+    }
+    argv[argc] = NULL;
+
+    reply->hPipe = hPipe;
+    InitializeCriticalSection(&reply->lock);
+    reply->failed = 0;
+    reply->broken = 0;
+    reply->used = 0;
+    strcpy(reply->cwd, cwd);
+    t_request = reply;
+
+    char **files;
+    int fileCount;
+    defaultOptions(&g_options);
+    int parsed = parseArguments(argc, argv, &files, &fileCount);
+    DWORD status = (DWORD)parsed;
+    if (parsed == PARSE_CONTINUE) {
+        listPaths(files, fileCount, NULL, GRAY_TEXT);
+        free(files);
+        status = EXIT_SUCCESS;
+    }
+    if (reply->failed)
+        status = EXIT_FAILURE;
+    t_request = NULL;
+
+    flushOutput(reply);
+    sendFrame(reply, LK_FRAME_EXIT, &status, sizeof(status));
+    FlushFileBuffers(hPipe);
+    DisconnectNamedPipe(hPipe);
+    CloseHandle(hPipe);
+    DeleteCriticalSection(&reply->lock);
+    free(reply);
+    free(argv);
+    free(request);
+}
+
+static DWORD WINAPI clientThread(LPVOID param) {
+    serveClient((HANDLE)param);
+    return 0;
+}
+
+/* --serve: answer lk --client requests on the per-user pipe until killed, each on its own thread */
+static int runServer(void) {
+    char pipeName[MAX_PATH];
+    getPipeName(pipeName, sizeof(pipeName));
+
+    g_dirCache = (DirCacheEntry *)calloc(DIR_CACHE_CAPACITY, sizeof(DirCacheEntry));
+    if (!g_dirCache)
+        fatalError("Memory allocation failed for directory cache.");
+
+    HANDLE hPipe = createServerPipe(pipeName, 1);
+    if (hPipe == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Error: Unable to create pipe '%s' (Error code: %lu); is lk --serve already running?\n",
+                pipeName, GetLastError());
+        return EXIT_FAILURE;
+    }
+    printf("lk: serving on %s\n", pipeName);
+    fflush(stdout);
+
+    for (;;) {
+        if (!ConnectNamedPipe(hPipe, NULL)) {
+            DWORD err = GetLastError();
+            if (err != ERROR_PIPE_CONNECTED) {
+                fprintf(stderr, "Warning: ConnectNamedPipe failed (Error code: %lu)\n", err);
+                DisconnectNamedPipe(hPipe);
+                continue;
+            }
+        }
+        /* Open the next instance first so the pipe name never vanishes while serving */
+        HANDLE hNext = createServerPipe(pipeName, 0);
+        HANDLE hThread = CreateThread(NULL, 0, clientThread, hPipe, 0, NULL);
+        if (hThread)
+            CloseHandle(hThread);
+        else
+            serveClient(hPipe);
+        while (hNext == INVALID_HANDLE_VALUE) {
+            fprintf(stderr, "Warning: Unable to create the next server pipe instance (Error code: %lu)\n",
+                    GetLastError());
+            Sleep(1000);
+            hNext = createServerPipe(pipeName, 0);
+        }
+        hPipe = hNext;
+    }
+}
+
+/* --client: send the arguments and working directory to the server, stream back its output and return its status */
+static int runClient(int argc, char *argv[]) {
+    char pipeName[MAX_PATH];
+    getPipeName(pipeName, sizeof(pipeName));
+
+    char cwd[MAX_PATH];
+    DWORD cwdLen = GetCurrentDirectoryA(MAX_PATH, cwd);
+    if (!cwdLen || cwdLen >= MAX_PATH)
+        fatalError("Unable to determine the current directory.");
+
+    size_t size = cwdLen + 1;
+    for (int i = 0; i < argc; i++)
+        size += strlen(argv[i]) + 1;
+    if (size > LK_MAX_REQUEST) {
+        fprintf(stderr, "Error: Request exceeds %d bytes.\n", LK_MAX_REQUEST);
+        return EXIT_FAILURE;
+    }
+    char *request = (char *)malloc(sizeof(DWORD) + size);
+    if (!request)
+        fatalError("Memory allocation failed for client request.");
+    DWORD payloadSize = (DWORD)size;
+    memcpy(request, &payloadSize, sizeof(payloadSize));
+    char *p = request + sizeof(DWORD);
+    memcpy(p, cwd, cwdLen + 1);
+    p += cwdLen + 1;
+    for (int i = 0; i < argc; i++) {
+        size_t len = strlen(argv[i]) + 1;
+        memcpy(p, argv[i], len);
+        p += len;
+    }
+
+    /* A busy pipe (every instance just taken by other clients) is retried, a missing one is not */
+    HANDLE hPipe;
+    ULONGLONG deadline = GetTickCount64() + LK_CLIENT_WAIT_MS;
+    for (;;) {
+        hPipe = CreateFileA(pipeName, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+        if (hPipe != INVALID_HANDLE_VALUE)
+            break;
+        DWORD err = GetLastError();
+        if (err == ERROR_PIPE_BUSY && GetTickCount64() < deadline) {
+            if (WaitNamedPipeA(pipeName, 1000) || GetLastError() == ERROR_SEM_TIMEOUT)
+                continue;
+            err = GetLastError();
+        }
+        if (err == ERROR_PIPE_BUSY || err == ERROR_SEM_TIMEOUT)
+            fprintf(stderr, "Error: lk server on '%s' stayed busy for %d seconds; try again later\n",
+                    pipeName, LK_CLIENT_WAIT_MS / 1000);
+        else
+            fprintf(stderr, "Error: No lk server on '%s' (Error code: %lu); start one with lk --serve\n",
+                    pipeName, err);
+        free(request);
+        return EXIT_FAILURE;
+    }
+
+    DWORD written = 0;
+    if (!WriteFile(hPipe, request, (DWORD)(sizeof(DWORD) + size), &written, NULL) ||
+        written != sizeof(DWORD) + size) {
+        fprintf(stderr, "Error: Unable to send request to '%s' (Error code: %lu)\n", pipeName, GetLastError());
+        CloseHandle(hPipe);
+        free(request);
+        return EXIT_FAILURE;
+    }
+    free(request);
+
+    /* Frames go through stdout and stderr, so text mode renders them as lk itself would */
+    static char buffer[LK_PIPE_BUFFER];
+    int status = -1;
+    for (;;) {
+        unsigned char header[1 + sizeof(DWORD)];
+        DWORD length;
+        if (!readPipeExact(hPipe, header, sizeof(header)))
+            break;
+        memcpy(&length, header + 1, sizeof(length));
+        if (header[0] == LK_FRAME_EXIT) {
+            DWORD code;
+            if (length == sizeof(code) && readPipeExact(hPipe, &code, sizeof(code)))
+                status = (int)code;
+            break;
+        }
+        if ((header[0] != LK_FRAME_STDOUT && header[0] != LK_FRAME_STDERR) || length > sizeof(buffer) ||
+            !readPipeExact(hPipe, buffer, length))
+            break;
+        FILE *stream = header[0] == LK_FRAME_STDERR ? stderr : stdout;
+        if (stream == stderr)
+            fflush(stdout);
+        fwrite(buffer, 1, length, stream);
+    }
+    CloseHandle(hPipe);
+    fflush(stdout);
+    if (status < 0) {
+        fprintf(stderr, "Error: The lk server on '%s' closed the connection before the request finished\n", pipeName);
+        return EXIT_FAILURE;
+    }
+    return status;
+}
+
+/* Main entry point for the directory listing utility */
+int main(int argc, char *argv[]) {
+    if (argc > 1 && !strcmp(argv[1], "--serve"))
+        return runServer();
+    if (argc > 1 && !strcmp(argv[1], "--client"))
+        return runClient(argc - 2, argv + 2);
+
+    defaultOptions(&g_options);
+
+    char **files;
+    int fileCount;
+    int status = parseArguments(argc, argv, &files, &fileCount);
+    if (status != PARSE_CONTINUE)
+        return status;
+
+    /* Initialize console handle and default attributes; colors are off when output is redirected */
+    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    CONSOLE_SCREEN_BUFFER_INFO csbi;
+    WORD defaultAttr;
+    if (!GetConsoleScreenBufferInfo(hConsole, &csbi)) {
+        defaultAttr = GRAY_TEXT; /* Fallback to gray if console info unavailable */
+        fprintf(stderr, "Warning: Failed to get console buffer info (Error code: %lu)\n", GetLastError());
+        hConsole = NULL;
+    } else {
+        defaultAttr = csbi.wAttributes;
+    }
+
+    listPaths(files, fileCount, hConsole, defaultAttr);
+    free(files);
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,487 @@
+/*
+ * liblk_test: checks liblk against the archives and git indexes in tests/fixtures,
+ * most of them malformed or truncated on purpose.
+ *
+ *   gcc -I. tests/liblk_test.c liblk.c -o liblk_test.exe
+ *   liblk_test.exe tests\fixtures
+ *
+ * Prints every failed check and exits with a failure status if there was one.
+ */
+#include "liblk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define UNIX_TIME 1700000000ULL   // Modification time of every fixture member and index entry
+
+static char g_fixtures[MAX_PATH];   // Absolute path of the fixture directory
+static char g_work[MAX_PATH];       // Scratch work tree for the git tests
+static int g_checks = 0, g_failures = 0;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void check(int ok, const char *what, int line) {
+    g_checks++;
+    if (!ok) {
+        g_failures++;
+        fprintf(stderr, "liblk_test.c:%d: check failed: %s\n", line, what);
+    }
+}
+
+/* Join the fixture directory and a relative path */
+static const char *fixturePath(const char *relative, char *path) {
+    snprintf(path, MAX_PATH, "%s\\%s", g_fixtures, relative);
+    return path;
+}
+
+/* Entries delivered by one enumeration, in delivery order */
+#define LISTING_MAX 32
+
+typedef struct {
+    int count;
+    char names[LISTING_MAX][MAX_PATH];
+    DWORD attributes[LISTING_MAX];
+    ULONGLONG sizes[LISTING_MAX];
+} Listing;
+
+static int collectListing(void *context, const FileEntry *entry) {
+    Listing *listing = (Listing *)context;
+    if (listing->count < LISTING_MAX) {
+        strcpy(listing->names[listing->count], entry->findData.cFileName);
+        listing->attributes[listing->count] = entry->findData.dwFileAttributes;
+        listing->sizes[listing->count] = ((ULONGLONG)entry->findData.nFileSizeHigh << 32) | entry->findData.nFileSizeLow;
+    }
+    listing->count++;
+    return 1;
+}
+
+/* Enumerate a fixture path; returns lkEnumerateDirectory's result with its error code preserved */
+static int listFixture(const LkOptions *options, const char *relative, Listing *listing) {
+    char path[MAX_PATH];
+    memset(listing, 0, sizeof(*listing));
+    return lkEnumerateDirectory(options, fixturePath(relative, path), collectListing, listing);
+}
+
+/* Position of name in listing, or -1 */
+static int findName(const Listing *listing, const char *name) {
+    for (int i = 0; i < listing->count && i < LISTING_MAX; i++) {
+        if (!strcmp(listing->names[i], name))
+            return i;
+    }
+    return -1;
+}
+
+/* name given in UTF-16, in the ANSI code page liblk reports names in */
+static const char *ansiName(const WCHAR *name, char *buffer) {
+    int len = WideCharToMultiByte(CP_ACP, 0, name, -1, buffer, MAX_PATH, NULL, NULL);
+    if (len <= 0)
+        buffer[0] = '\0';
+    return buffer;
+}
+
+static void testZip(void) {
+    LkOptions options;
+    lkDefaultOptions(&options);
+    Listing listing;
+    char name[MAX_PATH];
+    int i;
+
+    CHECK(listFixture(&options, "good.zip", &listing));
+    CHECK(listing.count == 5);
+    CHECK((i = findName(&listing, "readme.txt")) >= 0 && listing.sizes[i] == 5 &&
+          !(listing.attributes[i] & FILE_ATTRIBUTE_DIRECTORY));
+    CHECK((i = findName(&listing, "bin")) >= 0 && (listing.attributes[i] & FILE_ATTRIBUTE_DIRECTORY));
+    CHECK((i = findName(&listing, "docs")) >= 0 && (listing.attributes[i] & FILE_ATTRIBUTE_DIRECTORY));
+    CHECK(findName(&listing, "hidden.txt") < 0);
+    /* A name without the UTF-8 flag is code page 437, where 0x82 is e-acute */
+    CHECK(findName(&listing, ansiName(L"caf\u00e9.txt", name)) >= 0);
+    CHECK(findName(&listing, ansiName(L"na\u00efve.txt", name)) >= 0);
+
+    options.showAll = 1;
+    CHECK(listFixture(&options, "good.zip", &listing));
+    CHECK(listing.count == 6);
+    CHECK((i = findName(&listing, "hidden.txt")) >= 0 && (listing.attributes[i] & FILE_ATTRIBUTE_HIDDEN));
+    options.showAll = 0;
+
+    CHECK(listFixture(&options, "good.zip\\bin", &listing));
+    CHECK(listing.count == 1 && !strcmp(listing.names[0], "tool.exe") && listing.sizes[0] == 10);
+    CHECK(listFixture(&options, "good.zip/docs/", &listing));
+    CHECK(listing.count == 1 && !strcmp(listing.names[0], "guide.md"));
+    CHECK(listFixture(&options, "good.zip\\*.txt", &listing));
+    CHECK(listing.count == 3 && findName(&listing, "readme.txt") >= 0);
+
+    /* The last central directory record is cut short: the records before it still list */
+    CHECK(listFixture(&options, "truncated-cd.zip", &listing));
+    CHECK(listing.count == 4 && findName(&listing, ansiName(L"na\u00efve.txt", name)) < 0);
+
+    CHECK(!listFixture(&options, "no-eocd.zip", &listing));
+    CHECK(GetLastError() == ERROR_BAD_FORMAT && listing.count == 0);
+    CHECK(!listFixture(&options, "bad-offset.zip", &listing));
+    CHECK(GetLastError() == ERROR_BAD_FORMAT && listing.count == 0);
+    CHECK(listFixture(&options, "empty.zip", &listing));
+    CHECK(listing.count == 0);
+}
+
+static void testTar(void) {
+    LkOptions options;
+    lkDefaultOptions(&options);
+    Listing listing;
+    char name[MAX_PATH];
+    int i;
+
+    /* GNU volume label, ustar, GNU long name, pax path and ustar prefix headers in one archive */
+    CHECK(listFixture(&options, "good.tar", &listing));
+    CHECK(listing.count == 6);
+    CHECK(findName(&listing, "BACKUP") < 0);
+    CHECK((i = findName(&listing, "readme.txt")) >= 0 && listing.sizes[i] == 5);
+    CHECK((i = findName(&listing, "bin")) >= 0 && (listing.attributes[i] & FILE_ATTRIBUTE_DIRECTORY));
+    CHECK((i = findName(&listing, "link")) >= 0 && (listing.attributes[i] & FILE_ATTRIBUTE_REPARSE_POINT));
+    CHECK(findName(&listing, "deep") >= 0 && findName(&listing, "unicode") >= 0 && findName(&listing, "pre") >= 0);
+
+    CHECK(listFixture(&options, "good.tar\\bin", &listing));
+    CHECK(listing.count == 1 && !strcmp(listing.names[0], "tool.exe") && listing.sizes[0] == 10);
+    CHECK(listFixture(&options, "good.tar\\deep", &listing));
+    CHECK(listing.count == 1 && strlen(listing.names[0]) == 124);
+    CHECK(listFixture(&options, "good.tar\\unicode", &listing));
+    CHECK(listing.count == 1 && !strcmp(listing.names[0], ansiName(L"na\u00efve.txt", name)));
+
+    /* Checksum summed over signed chars, as some old tar implementations did */
+    CHECK(listFixture(&options, "signed-checksum.tar", &listing));
+    CHECK(listing.count == 1 && !strcmp(listing.names[0], "caf\xe9.txt"));
+
+    CHECK(!listFixture(&options, "bad-checksum.tar", &listing));
+    CHECK(GetLastError() == ERROR_BAD_FORMAT);
+    CHECK(listing.count == 1 && !strcmp(listing.names[0], "readme.txt"));
+
+    /* Archives that end early list what they hold up to that point */
+    CHECK(listFixture(&options, "truncated-header.tar", &listing));
+    CHECK(listing.count == 1 && !strcmp(listing.names[0], "readme.txt"));
+    CHECK(listFixture(&options, "truncated-data.tar", &listing));
+    CHECK(listing.count == 2 && findName(&listing, "bin") >= 0);
+    CHECK(!listFixture(&options, "truncated-pax.tar", &listing));
+    CHECK(listing.count == 1 && !strcmp(listing.names[0], "readme.txt"));
+
+    /* A pax record whose length overruns the header is ignored, not trusted */
+    CHECK(listFixture(&options, "malformed-pax.tar", &listing));
+    CHECK(listing.count == 2 && findName(&listing, "plain.txt") >= 0 && findName(&listing, "evil.txt") < 0);
+}
+
+static void testArchiveCache(void) {
+    LkOptions options;
+    lkDefaultOptions(&options);
+    LkArchiveCache cache;
+    lkArchiveCacheInit(&cache);
+    options.archiveCache = &cache;
+    Listing listing;
+
+    for (int pass = 0; pass < 2; pass++) {
+        CHECK(listFixture(&options, "good.zip", &listing));
+        CHECK(listing.count == 5);
+        CHECK(listFixture(&options, "good.zip\\bin", &listing));
+        CHECK(listing.count == 1 && !strcmp(listing.names[0], "tool.exe"));
+        CHECK(listFixture(&options, "good.tar\\deep", &listing));
+        CHECK(listing.count == 1);
+        CHECK(cache.count == 2);
+    }
+
+    /* An archive that fails to parse is listed as far as it goes and not cached */
+    CHECK(!listFixture(&options, "bad-checksum.tar", &listing));
+    CHECK(GetLastError() == ERROR_BAD_FORMAT);
+    CHECK(listing.count == 1 && !strcmp(listing.names[0], "readme.txt"));
+    CHECK(cache.count == 2);
+
+    lkArchiveCacheFree(&cache);
+    CHECK(cache.count == 0);
+}
+
+/* Write text to path, replacing any previous contents */
+static int writeTextFile(const char *path, const char *text) {
+    HANDLE hFile = CreateFileA(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return 0;
+    DWORD written = 0;
+    BOOL ok = WriteFile(hFile, text, (DWORD)strlen(text), &written, NULL);
+    CloseHandle(hFile);
+    return ok && written == strlen(text);
+}
+
+/* Point the scratch work tree at the fixture repository git\<name> through a ".git" file */
+static int openFixtureRepo(const char *name, LkGitRepo *repo) {
+    char link[MAX_PATH + 16], path[MAX_PATH], relative[MAX_PATH];
+    snprintf(relative, sizeof(relative), "git\\%s", name);
+    snprintf(link, sizeof(link), "gitdir: %s\n", fixturePath(relative, path));
+    snprintf(path, sizeof(path), "%s\\.git", g_work);
+    if (!writeTextFile(path, link))
+        return 0;
+    return lkGitOpenRepo(repo, g_work);
+}
+
+/* Find data as a listing would deliver it, stamped UNIX_TIME */
+static FileEntry makeEntry(const char *name, DWORD attributes, ULONGLONG size) {
+    FileEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    strcpy(entry.findData.cFileName, name);
+    entry.findData.dwFileAttributes = attributes;
+    entry.findData.nFileSizeLow = (DWORD)size;
+    entry.findData.nFileSizeHigh = (DWORD)(size >> 32);
+    ULONGLONG ticks = (UNIX_TIME + 11644473600ULL) * 10000000ULL;
+    entry.findData.ftLastWriteTime.dwLowDateTime = (DWORD)ticks;
+    entry.findData.ftLastWriteTime.dwHighDateTime = (DWORD)(ticks >> 32);
+    return entry;
+}
+
+/* Status of a file or directory entry named name in the work tree directory relative ("" = root) */
+static LkGitStatus entryStatus(LkGitRepo *repo, const char *relative, const char *name, int isDir, ULONGLONG size) {
+    char directory[MAX_PATH];
+    LkGitDirectory dir;
+    snprintf(directory, sizeof(directory), "%s%s%s", g_work, relative[0] ? "\\" : "", relative);
+    if (!lkGitOpenDirectory(&dir, repo, directory))
+        return (LkGitStatus)-1;
+    FileEntry entry = makeEntry(name, isDir ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_ARCHIVE, size);
+    LkGitStatus status = lkGitEntryStatus(&dir, &entry, 0);
+    lkGitCloseDirectory(&dir);
+    return status;
+}
+
+static void testGitIndex(void) {
+    /* Every version holds the same entries; version 4 prefix-compresses their names */
+    static const char *versions[] = { "v2", "v3", "v4" };
+    for (int v = 0; v < 3; v++) {
+        LkGitRepo repo;
+        int opened = openFixtureRepo(versions[v], &repo);
+        CHECK(opened);
+        if (!opened)
+            continue;
+        CHECK(repo.entryCount == 8);   /* Nine records; both stages of conflict.txt share one entry */
+
+        CHECK(entryStatus(&repo, "", "README.md", 0, 5) == LK_GIT_CLEAN);
+        CHECK(entryStatus(&repo, "", "readme.MD", 0, 5) == LK_GIT_CLEAN);
+        CHECK(entryStatus(&repo, "", "README.md", 0, 6) == LK_GIT_MODIFIED);
+        CHECK(entryStatus(&repo, "", "README.md", 1, 0) == LK_GIT_MODIFIED);
+        CHECK(entryStatus(&repo, "", "conflict.txt", 0, 11) == LK_GIT_MODIFIED);
+        CHECK(entryStatus(&repo, "", "sparse.txt", 0, 999) == LK_GIT_CLEAN);   /* assume-unchanged / skip-worktree */
+        CHECK(entryStatus(&repo, "", "sub", 1, 0) == LK_GIT_CLEAN);            /* Submodule */
+        CHECK(entryStatus(&repo, "", "new.txt", 0, 1) == LK_GIT_UNTRACKED);
+        CHECK(entryStatus(&repo, "", "scratch.tmp", 0, 1) == LK_GIT_IGNORED);  /* info/exclude */
+        CHECK(entryStatus(&repo, "", ".git", 1, 0) == LK_GIT_NONE);
+
+        /* Directories are judged from files already listed below them */
+        CHECK(entryStatus(&repo, "", "src", 1, 0) == LK_GIT_CLEAN);
+        CHECK(entryStatus(&repo, "src", "util.h", 0, 31) == LK_GIT_MODIFIED);
+        CHECK(entryStatus(&repo, "src", "util", 1, 0) == LK_GIT_CLEAN);      /* util.h sorts inside its run */
+        CHECK(entryStatus(&repo, "src\\util", "helper.c", 0, 40) == LK_GIT_CLEAN);
+        CHECK(entryStatus(&repo, "", "src", 1, 0) == LK_GIT_MODIFIED);
+        CHECK(entryStatus(&repo, "", "docs", 1, 0) == LK_GIT_CLEAN);
+        lkGitCloseRepo(&repo);
+    }
+
+    static const char *malformed[] = {
+        "bad-signature", "bad-version", "bad-count", "short", "truncated", "truncated-v4", "bad-strip"
+    };
+    for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); i++) {
+        LkGitRepo repo;
+        int opened = openFixtureRepo(malformed[i], &repo);
+        CHECK(!opened && GetLastError() == ERROR_BAD_FORMAT);
+        if (opened) {
+            fprintf(stderr, "  (index git\\%s was accepted)\n", malformed[i]);
+            lkGitCloseRepo(&repo);
+        }
+    }
+
+    /* An empty index tracks nothing */
+    LkGitRepo repo;
+    CHECK(openFixtureRepo("empty", &repo));
+    CHECK(repo.entryCount == 0);
+    CHECK(entryStatus(&repo, "", "README.md", 0, 5) == LK_GIT_UNTRACKED);
+    lkGitCloseRepo(&repo);
+}
+
+static void testGitIgnore(void) {
+    LkGitRepo repo;
+    int opened = openFixtureRepo("v2", &repo);
+    CHECK(opened);
+    if (!opened)
+        return;
+    CHECK(entryStatus(&repo, "", "x.o", 0, 1) == LK_GIT_IGNORED);
+    CHECK(entryStatus(&repo, "", "keep.o", 0, 1) == LK_GIT_UNTRACKED);    /* Negated */
+    CHECK(entryStatus(&repo, "", "build", 1, 0) == LK_GIT_IGNORED);
+    CHECK(entryStatus(&repo, "", "build", 0, 1) == LK_GIT_UNTRACKED);     /* "build/" matches directories only */
+    CHECK(entryStatus(&repo, "", "rooted.txt", 0, 1) == LK_GIT_IGNORED);
+    CHECK(entryStatus(&repo, "src", "rooted.txt", 0, 1) == LK_GIT_UNTRACKED);
+    CHECK(entryStatus(&repo, "src", "y.o", 0, 1) == LK_GIT_IGNORED);
+    CHECK(entryStatus(&repo, "", "#hash.txt", 0, 1) == LK_GIT_IGNORED);   /* Escaped '#' */
+    CHECK(entryStatus(&repo, "", "trailing.txt", 0, 1) == LK_GIT_IGNORED);
+    CHECK(entryStatus(&repo, "", "crlf.txt", 0, 1) == LK_GIT_IGNORED);
+    CHECK(entryStatus(&repo, "", "abc", 0, 1) == LK_GIT_UNTRACKED);       /* "[abc" never closes its class */
+    CHECK(entryStatus(&repo, "", "a", 0, 1) == LK_GIT_UNTRACKED);
+    CHECK(entryStatus(&repo, "logs", "c.log", 0, 1) == LK_GIT_IGNORED);
+    CHECK(entryStatus(&repo, "logs\\a\\b", "c.log", 0, 1) == LK_GIT_IGNORED);
+    CHECK(entryStatus(&repo, "logs\\a\\b", "c.txt", 0, 1) == LK_GIT_UNTRACKED);
+    CHECK(entryStatus(&repo, "build\\out", "main.c", 0, 1) == LK_GIT_IGNORED);   /* Inside an ignored directory */
+
+    LkGitDirectory dir;
+    CHECK(!lkGitOpenDirectory(&dir, &repo, g_fixtures) && GetLastError() == ERROR_INVALID_PARAMETER);
+    lkGitCloseRepo(&repo);
+}
+
+static void testThrottle(void) {
+    LkThrottle throttle;
+    lkThrottleTake(NULL, 1e9);   /* No throttle: returns at once */
+
+    CHECK(lkThrottleInit(&throttle, 0, 0));
+    ULONGLONG start = GetTickCount64();
+    lkThrottleTake(&throttle, 1e9);
+    CHECK(GetTickCount64() - start < 100);
+    lkThrottleFree(&throttle);
+
+    /* 1000 entries per second with a 100-entry bucket: 300 more entries take 300 ms */
+    CHECK(lkThrottleInit(&throttle, 1000, 0));
+    start = GetTickCount64();
+    lkThrottleTake(&throttle, 100);
+    lkThrottleTake(&throttle, 300);
+    ULONGLONG elapsed = GetTickCount64() - start;
+    CHECK(elapsed >= 250 && elapsed < 5000);
+    lkThrottleFree(&throttle);
+
+    /* One enumeration at a time; the slot comes back after a failed enumeration too */
+    LkOptions options;
+    lkDefaultOptions(&options);
+    CHECK(lkThrottleInit(&throttle, 0, 1));
+    options.throttle = &throttle;
+    Listing listing;
+    CHECK(listFixture(&options, "good.zip", &listing) && listing.count == 5);
+    CHECK(!listFixture(&options, "no-eocd.zip", &listing) && GetLastError() == ERROR_BAD_FORMAT);
+    CHECK(listFixture(&options, "good.tar", &listing) && listing.count == 6);
+    CHECK(WaitForSingleObject(throttle.slots, 0) == WAIT_OBJECT_0);
+    ReleaseSemaphore(throttle.slots, 1, NULL);
+    lkThrottleFree(&throttle);
+}
+
+/* Fold one file named name of size bytes, age days old, into stats */
+static void addFile(LkStats *stats, const char *name, ULONGLONG size, ULONGLONG days) {
+    FileEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    strcpy(entry.findData.cFileName, name);
+    entry.findData.nFileSizeLow = (DWORD)size;
+    entry.findData.nFileSizeHigh = (DWORD)(size >> 32);
+    ULONGLONG ticks = stats->now - days * 864000000000ULL;
+    entry.findData.ftLastWriteTime.dwLowDateTime = (DWORD)ticks;
+    entry.findData.ftLastWriteTime.dwHighDateTime = (DWORD)(ticks >> 32);
+    lkStatsAddFile(stats, &entry);
+}
+
+static ULONGLONG extFiles(const LkStats *stats, const char *ext) {
+    for (size_t i = 0; i < LK_EXT_SLOTS; i++) {
+        if (stats->exts[i].files && !strcmp(stats->exts[i].ext, ext))
+            return stats->exts[i].files;
+    }
+    return 0;
+}
+
+static int compareBytes(const void *a, const void *b) {
+    ULONGLONG x = ((const LkDirStat *)a)->bytes, y = ((const LkDirStat *)b)->bytes;
+    return x < y ? -1 : x > y;
+}
+
+static void testStatsMerge(void) {
+    static LkStats whole, parts[2], empty;
+    static const char *names[] = { "a.txt", "B.TXT", "c.log", "Makefile", ".gitignore", "d.tar.gz",
+                                   "e.averyveryverylongextension", "f.c" };
+    FILETIME now = { 0, 0x01DA0000 };
+    lkStatsInit(&whole, &now);
+    lkStatsInit(&parts[0], &now);
+    lkStatsInit(&parts[1], &now);
+    for (int i = 0; i < 64; i++) {
+        const char *name = names[i % 8];
+        ULONGLONG size = i % 5 ? (1ULL << (i % 41)) + (ULONGLONG)i : 0;
+        addFile(&whole, name, size, (ULONGLONG)i * 37);
+        addFile(&parts[i % 2], name, size, (ULONGLONG)i * 37);
+    }
+    for (int i = 0; i < 24; i++) {
+        char path[32];
+        snprintf(path, sizeof(path), "C:\\dir%d", i);
+        lkStatsAddDirectory(&whole, path, 1, (ULONGLONG)(i * 7919 % 101));
+        lkStatsAddDirectory(&parts[i % 2], path, 1, (ULONGLONG)(i * 7919 % 101));
+    }
+    lkStatsMerge(&parts[0], &parts[1]);
+
+    LkStats *merged = &parts[0];
+    CHECK(merged->files == whole.files && merged->bytes == whole.bytes);
+    CHECK(!memcmp(merged->sizeFiles, whole.sizeFiles, sizeof(whole.sizeFiles)));
+    CHECK(!memcmp(merged->sizeBytes, whole.sizeBytes, sizeof(whole.sizeBytes)));
+    CHECK(!memcmp(merged->ageFiles, whole.ageFiles, sizeof(whole.ageFiles)));
+    CHECK(!memcmp(merged->ageBytes, whole.ageBytes, sizeof(whole.ageBytes)));
+    CHECK(merged->extCount == whole.extCount && merged->otherExtFiles == whole.otherExtFiles);
+    CHECK(extFiles(merged, "txt") == 16 && extFiles(&whole, "txt") == 16);
+    CHECK(extFiles(merged, "") == 16);   /* "Makefile" and ".gitignore" have no extension */
+    CHECK(extFiles(merged, "gz") == 8 && merged->otherExtFiles == 8);
+    CHECK(merged->topDirCount == LK_TOP_DIRS && whole.topDirCount == LK_TOP_DIRS);
+    qsort(merged->topDirs, merged->topDirCount, sizeof(LkDirStat), compareBytes);
+    qsort(whole.topDirs, whole.topDirCount, sizeof(LkDirStat), compareBytes);
+    int sameTop = 1;
+    for (size_t i = 0; i < LK_TOP_DIRS; i++)
+        sameTop &= merged->topDirs[i].bytes == whole.topDirs[i].bytes;
+    CHECK(sameTop);
+
+    /* Partials whose extensions only overflow the table once combined still add up */
+    lkStatsInit(&parts[0], &now);
+    lkStatsInit(&parts[1], &now);
+    for (int i = 0; i < 600; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "file.e%d", i);
+        addFile(&parts[i % 2], name, 10, 1);
+    }
+    lkStatsInit(&empty, &now);
+    lkStatsMerge(&empty, &parts[0]);
+    lkStatsMerge(&empty, &parts[1]);
+    ULONGLONG named = 0;
+    for (size_t i = 0; i < LK_EXT_SLOTS; i++)
+        named += empty.exts[i].files;
+    CHECK(empty.files == 600 && empty.bytes == 6000);
+    CHECK(empty.extCount == LK_EXT_SLOTS * 3 / 4 && named + empty.otherExtFiles == 600);
+    CHECK(empty.otherExtBytes == empty.otherExtFiles * 10);
+}
+
+/* Remove the scratch work tree */
+static void removeWorkTree(void) {
+    char path[MAX_PATH];
+    snprintf(path, sizeof(path), "%s\\.git", g_work);
+    DeleteFileA(path);
+    snprintf(path, sizeof(path), "%s\\.gitignore", g_work);
+    DeleteFileA(path);
+    RemoveDirectoryA(g_work);
+}
+
+int main(int argc, char *argv[]) {
+    const char *fixtures = argc > 1 ? argv[1] : "tests\\fixtures";
+    char path[MAX_PATH], temp[MAX_PATH];
+    DWORD len = GetFullPathNameA(fixtures, MAX_PATH, g_fixtures, NULL);
+    if (!len || len >= MAX_PATH || GetFileAttributesA(fixturePath("good.zip", path)) == INVALID_FILE_ATTRIBUTES) {
+        fprintf(stderr, "Error: No fixtures in '%s'\n", fixtures);
+        return EXIT_FAILURE;
+    }
+    len = GetTempPathA(MAX_PATH, temp);
+    if (!len || len >= MAX_PATH) {
+        fprintf(stderr, "Error: Unable to find the temporary directory (Error code: %lu)\n", GetLastError());
+        return EXIT_FAILURE;
+    }
+    snprintf(g_work, sizeof(g_work), "%slk-test-%lu", temp, GetCurrentProcessId());
+    snprintf(temp, sizeof(temp), "%s\\.gitignore", g_work);
+    if (!CreateDirectoryA(g_work, NULL) || !CopyFileA(fixturePath("git\\gitignore", path), temp, FALSE)) {
+        fprintf(stderr, "Error: Unable to create '%s' (Error code: %lu)\n", g_work, GetLastError());
+        removeWorkTree();
+        return EXIT_FAILURE;
+    }
+
+    testZip();
+    testTar();
+    testArchiveCache();
+    testGitIndex();
+    testGitIgnore();
+    testThrottle();
+    testStatsMerge();
+
+    removeWorkTree();
+    printf("%d checks, %d failed\n", g_checks, g_failures);
+    return g_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}